@@ -0,0 +1,181 @@
+#include "arena.h"
+
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "check.h"
+
+namespace base {
+
+struct Arena::Chunk {
+  Chunk* next;
+  // including the header
+  std::size_t size;
+  bool mapped;
+};
+
+struct Arena::Cleanup {
+  void* object;
+  void (*destroy)(void*);
+  Cleanup* next;
+};
+
+const std::size_t Arena::kChunkHeader =
+    (sizeof(Arena::Chunk) + alignof(std::max_align_t) - 1) &
+    ~(alignof(std::max_align_t) - 1);
+
+namespace {
+
+std::size_t RoundUp(std::size_t size, std::size_t align) {
+  return (size + align - 1) & ~(align - 1);
+}
+
+// a mapping aligned to |Arena::kHugePageSize|, so that every huge page of it
+// can be backed by a transparent one
+void* MapHugePages(std::size_t size) {
+  auto mapped = size + Arena::kHugePageSize;
+  auto p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return nullptr;
+  }
+
+  auto begin = reinterpret_cast<std::uintptr_t>(p);
+  auto aligned = RoundUp(begin, Arena::kHugePageSize);
+  if (aligned > begin) {
+    munmap(p, aligned - begin);
+  }
+  auto end = begin + mapped;
+  if (end > aligned + size) {
+    munmap(reinterpret_cast<void*>(aligned + size), end - aligned - size);
+  }
+
+  madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+  return reinterpret_cast<void*>(aligned);
+}
+
+}  // namespace
+
+Arena::Arena(const Options& options) : options_(options) {
+  if (options_.huge_pages) {
+    options_.chunk_size = RoundUp(options_.chunk_size, kHugePageSize);
+  }
+  CHECK(options_.chunk_size > kChunkHeader);
+}
+
+Arena::~Arena() {
+  RunCleanups();
+  for (auto list : {chunks_, free_chunks_}) {
+    while (list) {
+      auto next = list->next;
+      FreeChunk(list);
+      list = next;
+    }
+  }
+}
+
+void Arena::Reset() {
+  RunCleanups();
+
+  while (chunks_) {
+    auto chunk = chunks_;
+    chunks_ = chunk->next;
+    if (chunk->size == options_.chunk_size) {
+      chunk->next = free_chunks_;
+      free_chunks_ = chunk;
+    } else {
+      FreeChunk(chunk);
+    }
+  }
+
+  cursor_ = 0;
+  limit_ = 0;
+  allocated_ = 0;
+}
+
+void* Arena::AllocateSlow(std::size_t size, std::size_t align) {
+  CHECK(size <= SIZE_MAX - kChunkHeader - align);
+  auto needed = kChunkHeader + size + align;
+
+  // larger than a chunk, it gets one of its own size, behind the current
+  // chunk, whose space left is kept for the next allocations
+  if (needed > options_.chunk_size) {
+    auto chunk = NewChunk(needed);
+    if (chunks_ && cursor_ != 0) {
+      chunk->next = chunks_->next;
+      chunks_->next = chunk;
+    } else {
+      chunk->next = chunks_;
+      chunks_ = chunk;
+    }
+
+    allocated_ += size;
+    auto data = reinterpret_cast<std::uintptr_t>(chunk) + kChunkHeader;
+    return reinterpret_cast<void*>(RoundUp(data, align));
+  }
+
+  Chunk* chunk = free_chunks_;
+  if (chunk) {
+    free_chunks_ = chunk->next;
+  } else {
+    chunk = NewChunk(options_.chunk_size);
+  }
+  Use(chunk);
+
+  return Allocate(size, align);
+}
+
+void Arena::AddCleanup(void* object, void (*destroy)(void*)) {
+  auto cleanup = static_cast<Cleanup*>(
+      Allocate(sizeof(Cleanup), alignof(Cleanup)));
+  cleanup->object = object;
+  cleanup->destroy = destroy;
+  cleanup->next = cleanups_;
+  cleanups_ = cleanup;
+}
+
+void Arena::RunCleanups() {
+  // the destructors may add cleanups as well
+  while (auto cleanup = cleanups_) {
+    cleanups_ = cleanup->next;
+    cleanup->destroy(cleanup->object);
+  }
+}
+
+Arena::Chunk* Arena::NewChunk(std::size_t size) {
+  void* memory = nullptr;
+  bool mapped = false;
+  if (options_.huge_pages) {
+    size = RoundUp(size, kHugePageSize);
+    memory = MapHugePages(size);
+    mapped = memory != nullptr;
+  }
+  if (!memory) {
+    memory = std::malloc(size);
+    CHECK(memory);
+  }
+
+  reserved_ += size;
+  return ::new (memory) Chunk{nullptr, size, mapped};
+}
+
+void Arena::FreeChunk(Chunk* chunk) {
+  reserved_ -= chunk->size;
+  if (chunk->mapped) {
+    munmap(chunk, chunk->size);
+  } else {
+    std::free(chunk);
+  }
+}
+
+void Arena::Use(Chunk* chunk) {
+  chunk->next = chunks_;
+  chunks_ = chunk;
+
+  cursor_ = reinterpret_cast<std::uintptr_t>(chunk) + kChunkHeader;
+  limit_ = reinterpret_cast<std::uintptr_t>(chunk) + chunk->size;
+}
+
+}  // namespace base
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "macros.h"
+
+namespace base {
+
+// |Arena| is a bump allocator, the memory is carved out of chunks and is
+// released all at once, by |Reset| or the destructor. the objects created by
+// |New| are destroyed then, in the reverse order.
+//
+// |Reset| keeps the chunks of the default size for the next allocations, so
+// an arena reset per request stops allocating after the first few requests.
+// with |huge_pages|, the chunks are 2MB aligned mappings advised to be backed
+// by transparent huge pages.
+//
+// it's not thread safe, an arena is owned by a single thread or request.
+class Arena {
+ public:
+  static constexpr std::size_t kDefaultChunkSize = 64 * 1024;
+  static constexpr std::size_t kHugePageSize = 2 * 1024 * 1024;
+
+  struct Options {
+    std::size_t chunk_size{kDefaultChunkSize};
+    bool huge_pages{false};
+  };
+
+  Arena() : Arena(Options{}) {}
+  explicit Arena(const Options& options);
+  ~Arena();
+
+  void* Allocate(std::size_t size,
+                 std::size_t align = alignof(std::max_align_t)) {
+    auto p = (cursor_ + align - 1) & ~(align - 1);
+    if (cursor_ != 0 && p <= limit_ && size <= limit_ - p) {
+      cursor_ = p + size;
+      allocated_ += size;
+      return reinterpret_cast<void*>(p);
+    }
+    return AllocateSlow(size, align);
+  }
+
+  template <typename T, typename... ARGS>
+  T* New(ARGS&&... args) {
+    auto object = ::new (Allocate(sizeof(T), alignof(T)))
+        T(std::forward<ARGS>(args)...);
+    if constexpr (!std::is_trivially_destructible<T>::value) {
+      AddCleanup(object, [](void* p) { static_cast<T*>(p)->~T(); });
+    }
+    return object;
+  }
+
+  // destroy the objects, and rewind to the retained chunks
+  void Reset();
+
+  // bytes handed out since the last reset, and the ones held by the chunks
+  std::size_t allocated() const { return allocated_; }
+  std::size_t reserved() const { return reserved_; }
+
+ private:
+  struct Chunk;
+  struct Cleanup;
+
+  // the chunk header, followed by the memory handed out
+  static const std::size_t kChunkHeader;
+
+  void* AllocateSlow(std::size_t size, std::size_t align);
+  void AddCleanup(void* object, void (*destroy)(void*));
+  void RunCleanups();
+
+  Chunk* NewChunk(std::size_t size);
+  void FreeChunk(Chunk* chunk);
+  void Use(Chunk* chunk);
+
+ private:
+  Options options_;
+
+  std::uintptr_t cursor_{0};
+  std::uintptr_t limit_{0};
+
+  // the chunks in use, the current one first, and the ones kept by |Reset|
+  Chunk* chunks_{nullptr};
+  Chunk* free_chunks_{nullptr};
+  Cleanup* cleanups_{nullptr};
+
+  std::size_t allocated_{0};
+  std::size_t reserved_{0};
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(Arena);
+};
+
+// |ArenaAllocator| is the allocator adapter of |Arena|, the memory is freed
+// with the arena, |deallocate| does nothing.
+//
+// eg.
+// std::vector<int, ArenaAllocator<int>> v{ArenaAllocator<int>{&arena}};
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T*, std::size_t) {}
+
+  Arena* arena() const { return arena_; }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const {
+    return arena_ == other.arena();
+  }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const {
+    return arena_ != other.arena();
+  }
+
+ private:
+  Arena* arena_;
+};
+
+}  // namespace base
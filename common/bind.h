@@ -1,8 +1,10 @@
 #pragma once
 
 #include <memory>
+#include <type_traits>
 
 #include "trait.h"
+#include "weak-anchor.h"
 
 namespace base {
 namespace _ {
@@ -82,6 +84,37 @@ struct WeakFunctorVoidReturn : WeakFunctorBase<Functor, Object> {
   }
 };
 
+// HandleFunctor, slient once the anchor of |handle| is gone. it's as trivial
+// to copy as |Functor|, so a small one is stored by |std::function| inline,
+// without an allocation of its own. it doesn't save the ones of the caller,
+// e.g. the hop a promise posts to run it.
+template <typename Functor>
+struct HandleFunctor : WrapperFunctor {
+  using ReturnType = typename ExtractFunctionSig<Functor>::ReturnType;
+
+  HandleFunctor(WeakHandle h, Functor&& f) : handle(h), functor(std::move(f)) {}
+  HandleFunctor(WeakHandle h, const Functor& f) : handle(h), functor(f) {}
+
+  template <typename... ARGS>
+  ReturnType operator()(ARGS&&... args) {
+    if (!handle.IsValid()) {
+      if constexpr (std::is_void<ReturnType>::value) {
+        return;
+      } else {
+        return ReturnType{};
+      }
+    }
+    return std::forward<Functor>(functor)(std::forward<ARGS>(args)...);
+  }
+
+  bool IsSilent() const { return !handle.IsValid(); }
+  operator bool() const { return !IsSilent(); }
+
+ public:
+  WeakHandle handle;
+  Functor functor;
+};
+
 }  // namespace _
 
 template <typename T>
@@ -100,6 +133,21 @@ WeakObject BindWeakFunctor(std::weak_ptr<Object>&& weak_ptr, F&& callback) {
   return WeakObject{std::move(weak_ptr), std::forward<F>(callback)};
 }
 
+// bound to the |anchor| of an object instead of a |std::weak_ptr|, the object
+// is not kept alive while |callback| runs, so it must be run in the sequence
+// destroying the object, see |WeakHandle|.
+template <typename F, typename Functor = std::decay_t<F>>
+_::HandleFunctor<Functor> BindWeakFunctor(const WeakAnchor& anchor,
+                                          F&& callback) {
+  return _::HandleFunctor<Functor>{anchor.GetHandle(),
+                                   std::forward<F>(callback)};
+}
+
+template <typename Object, typename F>
+auto BindWeakFunctor(Object* raw, F&& callback) {
+  return BindWeakFunctor(raw->weak_from_this(), std::forward<F>(callback));
+}
+
 template <typename Object, typename F>
 typename ExtractFunctionSig<F>::WrapperType BindWeak(
     std::weak_ptr<Object>&& weak_ptr, F&& callback) {
@@ -111,7 +159,15 @@ typename ExtractFunctionSig<F>::WrapperType BindWeak(
 template <typename Object, typename F>
 typename ExtractFunctionSig<F>::WrapperType BindWeak(Object* raw,
                                                      F&& callback) {
-  return BindWeak(raw->weak_from_this(), std::forward<F>(callback));
+  using WrapperType = typename ExtractFunctionSig<F>::WrapperType;
+  return WrapperType{BindWeakFunctor(raw, std::forward<F>(callback))};
+}
+
+template <typename F>
+typename ExtractFunctionSig<F>::WrapperType BindWeak(const WeakAnchor& anchor,
+                                                     F&& callback) {
+  using WrapperType = typename ExtractFunctionSig<F>::WrapperType;
+  return WrapperType{BindWeakFunctor(anchor, std::forward<F>(callback))};
 }
 
 // BindStrong
@@ -122,6 +178,11 @@ _::StrongFunctor<F, Object> BindStrongFunctor(std::shared_ptr<Object>&& ptr,
   return StrongObject{std::move(ptr), std::forward<F>(callback)};
 }
 
+template <typename Object, typename F>
+auto BindStrongFunctor(Object* raw, F&& callback) {
+  return BindStrongFunctor(raw->shared_from_this(), std::forward<F>(callback));
+}
+
 template <typename Object, typename F>
 typename ExtractFunctionSig<F>::WrapperType BindStrong(
     std::shared_ptr<Object>&& ptr, F&& callback) {
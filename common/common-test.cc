@@ -0,0 +1,558 @@
+#define CATCH_CONFIG_MAIN
+#include "common.h"
+
+#include <fmt/format.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <catch-include.h>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "crash-handler.h"
+#include "error.h"
+#include "histogram.h"
+#include "object-pool.h"
+#include "profiler.h"
+#include "result.h"
+
+namespace base {
+
+TEST_CASE("stack trace into buffer", "[common]") {
+  std::string (*f)() = &base::GetStackTrace;
+  auto pc = reinterpret_cast<const void*>(f);
+
+  // resolved, then cached
+  char name[kMaxSymbolLength];
+  REQUIRE(Symbolize(pc, name, sizeof(name)));
+  REQUIRE(std::string{name}.find("GetStackTrace") != std::string::npos);
+  char cached[kMaxSymbolLength];
+  REQUIRE(Symbolize(pc, cached, sizeof(cached)));
+  REQUIRE(std::string{cached} == name);
+
+  char tiny[4];
+  REQUIRE(Symbolize(pc, tiny, sizeof(tiny)));
+  REQUIRE(std::string{tiny} == std::string{name}.substr(0, 3));
+  // nothing written, not even the terminator
+  REQUIRE(!Symbolize(pc, tiny, 0));
+  REQUIRE(GetStackTrace(tiny, 0) == 0);
+  REQUIRE(std::string{tiny} == std::string{name}.substr(0, 3));
+
+  // truncated, and always terminated
+  char bt[16];
+  auto length = GetStackTrace(bt, sizeof(bt));
+  REQUIRE(length < sizeof(bt));
+  REQUIRE(bt[length] == '\0');
+
+  void* frames[] = {const_cast<void*>(pc), nullptr};
+  char lines[2 * kMaxSymbolLength];
+  SymbolizeStackTrace(frames, 2, lines, sizeof(lines));
+  REQUIRE(std::string{lines} == std::string{name} + "\n0x0\n");
+
+  // not resolved, then cached as such
+  auto unknown = reinterpret_cast<const void*>(std::uintptr_t{8});
+  REQUIRE(!Symbolize(unknown, name, sizeof(name)));
+  REQUIRE(!Symbolize(unknown, name, sizeof(name)));
+}
+
+__attribute__((noinline)) int ThrowingCall() {
+  throw std::runtime_error("boom");
+}
+
+TEST_CASE("die on exception", "[common]") {
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+
+  auto child = fork();
+  REQUIRE(child >= 0);
+  if (child == 0) {
+    struct rlimit no_core = {0, 0};
+    setrlimit(RLIMIT_CORE, &no_core);
+    close(fds[0]);
+    signal(SIGABRT, SIG_DFL);
+    dup2(fds[1], STDERR_FILENO);
+    NO_EXCEPT(ThrowingCall());
+    _exit(0);
+  }
+
+  close(fds[1]);
+  std::string report;
+  char buffer[4096];
+  for (ssize_t n; (n = read(fds[0], buffer, sizeof(buffer))) > 0;) {
+    report.append(buffer, static_cast<std::size_t>(n));
+  }
+  close(fds[0]);
+
+  int status = 0;
+  REQUIRE(waitpid(child, &status, 0) == child);
+  INFO(report);
+  REQUIRE(WIFSIGNALED(status));
+  REQUIRE(WTERMSIG(status) == SIGABRT);
+  REQUIRE(report.rfind("[die]: ", 0) == 0);
+  REQUIRE(report.find("common-test.cc:") != std::string::npos);
+  REQUIRE(report.find(": ThrowingCall() thrown exception boom\n") !=
+          std::string::npos);
+}
+
+__attribute__((noinline)) std::uint64_t ProfiledBusyLoop() {
+  std::uint64_t x = 0;
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(200);
+  while (std::chrono::steady_clock::now() < deadline) {
+    for (int i = 0; i < 1000; ++i) {
+      x = x * 6364136223846793005ull + 1442695040888963407ull;
+    }
+  }
+  return x;
+}
+
+TEST_CASE("profiler", "[common]") {
+  auto profiler = Profiler::Get();
+  profiler->Reset();
+
+  REQUIRE(profiler->Start(1000));
+  REQUIRE(!profiler->Start(1000));
+
+  std::atomic<std::uint64_t> sink{0};
+  std::thread worker([&]() {
+    profiler->RegisterThread();
+    sink += ProfiledBusyLoop();
+  });
+  worker.join();
+  profiler->Stop();
+
+  REQUIRE(profiler->samples() > 0);
+#if !defined(__SANITIZE_THREAD__)
+  // the unwinder finds no frames in a signal handler under tsan
+  auto folded = profiler->GetFoldedStacks();
+  REQUIRE(folded.find("ProfiledBusyLoop") != std::string::npos);
+  REQUIRE(folded.back() == '\n');
+#endif
+
+  profiler->Reset();
+  REQUIRE(profiler->samples() == 0);
+  REQUIRE(profiler->GetFoldedStacks().empty());
+}
+
+// read through a volatile, so the compiler can not tell the store faults, and
+// drop the call at -O2
+int* volatile g_null = nullptr;
+
+__attribute__((noinline)) void CrashingCallback() { *g_null = 1; }
+
+TEST_CASE("crash handler", "[common]") {
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+
+  auto child = fork();
+  REQUIRE(child >= 0);
+  if (child == 0) {
+    struct rlimit no_core = {0, 0};
+    setrlimit(RLIMIT_CORE, &no_core);
+    close(fds[0]);
+    // the handlers of catch are not chained to
+    for (auto signo : {SIGSEGV, SIGBUS, SIGABRT, SIGFPE}) {
+      signal(signo, SIG_DFL);
+    }
+    InstallCrashHandler(fds[1]);
+
+    std::thread idle([]() {
+      std::this_thread::sleep_for(std::chrono::seconds(10));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CrashingCallback();
+    _exit(0);
+  }
+
+  close(fds[1]);
+  std::string report;
+  char buffer[4096];
+  for (ssize_t n; (n = read(fds[0], buffer, sizeof(buffer))) > 0;) {
+    report.append(buffer, static_cast<std::size_t>(n));
+  }
+  close(fds[0]);
+
+  int status = 0;
+  REQUIRE(waitpid(child, &status, 0) == child);
+  INFO(report);
+  // re-raised to the default action
+  REQUIRE(WIFSIGNALED(status));
+  REQUIRE(WTERMSIG(status) == SIGSEGV);
+  REQUIRE(report.rfind("*** SIGSEGV received at 0x0 by thread ", 0) == 0);
+  REQUIRE(report.find("CrashingCallback") != std::string::npos);
+  REQUIRE(report.find("\n*** thread ") != std::string::npos);
+}
+
+namespace {
+
+#define TEST_ERROR_LIST(__)      \
+  __(kTestErrorFailed, "failed") \
+  __(kTestErrorClosed, "closed")
+
+enum TestError {
+#define __(A, B) A,
+  TEST_ERROR_LIST(__)
+#undef __
+};
+
+struct TestCategory : public Error::Category {
+  const char* GetName() const override { return "test"; }
+  std::string GetInformation(std::uint32_t c) const override {
+    switch (c) {
+#define __(A, B) \
+  case A:        \
+    return fmt::format("test[{}]", B);
+      TEST_ERROR_LIST(__)
+#undef __
+      default:
+        return "test[none]";
+    }
+  }
+};
+
+TestCategory* RegisterTestCategory() {
+  static TestCategory kC;
+  ErrorRegistry::Register(&kC, {
+#define __(A, B) A,
+      TEST_ERROR_LIST(__)
+#undef __
+  });
+  return &kC;
+}
+
+const Error::Category* Cat() {
+  static TestCategory* kC = RegisterTestCategory();
+  return kC;
+}
+
+// the same helpers as the ones of the event errors
+Error Err(TestError e) { return Error{Cat(), e}; }
+
+Error Err(TestError e, std::string msg) {
+  return Error{Cat(), e, std::move(msg)};
+}
+
+Error Err(TestError e, Error::StaticMessage msg) {
+  return Error{Cat(), e, msg};
+}
+
+template <typename A, typename... T>
+Error Err(TestError e, const char* format, A&& arg, T&&... args) {
+  return Error::Lazy(Cat(), e, format, std::forward<A>(arg),
+                     std::forward<T>(args)...);
+}
+
+}  // namespace
+
+TEST_CASE("error message", "[common]") {
+  auto error = Err(kTestErrorClosed, "closed");
+  REQUIRE(error.GetMessage() == "closed");
+
+  // the captured string is copied, the lazy message outlives it
+  {
+    std::string name = "ch";
+    error = Err(kTestErrorClosed, "{} closed after {}",
+                std::string_view{name}, 3);
+  }
+  auto copy = error;
+  REQUIRE(copy.GetMessage() == "ch closed after 3");
+  REQUIRE(error.PassMessage() == "ch closed after 3");
+  REQUIRE(!error.HasMessage());
+  REQUIRE(error.code() == kTestErrorClosed);
+  REQUIRE(copy.HasMessage());
+
+  // the text and the arguments are copied, unless the message is static. the
+  // format of a lazy message is a literal, it's referenced.
+  {
+    char text[16] = "stack text";
+    error = Err(kTestErrorClosed, text);
+    copy = Err(kTestErrorClosed, "{} of {}", text, 2);
+    text[0] = 'x';
+  }
+  REQUIRE(error.GetMessage() == "stack text");
+  REQUIRE(copy.GetMessage() == "stack text of 2");
+  REQUIRE(Err(kTestErrorClosed, Error::StaticMessage{"static"})
+              .GetMessage() == "static");
+
+  auto interned = Error::StaticMessage::Intern(std::string{"interned"});
+  REQUIRE(interned.text() ==
+          Error::StaticMessage::Intern("interned").text());
+  REQUIRE(Error(Cat(), kTestErrorFailed, interned).GetMessage() ==
+          "interned");
+}
+
+TEST_CASE("error stack", "[common]") {
+  Error::SetStackSampling(2);
+  auto sampled = Err(kTestErrorClosed, "closed");
+  auto skipped = Err(kTestErrorClosed, "closed");
+  Error::SetStackSampling(0);
+
+  REQUIRE(sampled.HasStackTrace());
+  REQUIRE(!skipped.HasStackTrace());
+  REQUIRE(sampled.GetMessage() == "closed");
+
+  // the stack is shared by the copies, and printed along with the error
+  auto copy = sampled;
+  REQUIRE(copy.HasStackTrace());
+  REQUIRE(copy.ToString().rfind("test[closed]: closed", 0) ==
+          0);
+  REQUIRE(!Err(kTestErrorClosed).HasStackTrace());
+}
+
+TEST_CASE("error registry", "[common]") {
+  auto error = Err(kTestErrorClosed);
+  REQUIRE(error.information() == "test[closed]");
+  // cached, the same string every time
+  REQUIRE(error.information().data() == error.information().data());
+
+  // not registered, formatted once on demand
+  Error unknown{Cat(), 1000};
+  REQUIRE(unknown.information() == "test[none]");
+  REQUIRE(unknown.information().data() == unknown.information().data());
+
+  // a wide code space does not grow the table of the category, the strings
+  // handed out stay valid while it's republished
+  auto information = error.information();
+  for (std::uint32_t code = 2000; code < 4000; ++code) {
+    REQUIRE(Error{Cat(), code}.information() == "test[none]");
+  }
+  ErrorRegistry::Register(Cat(), {kTestErrorFailed});
+  REQUIRE(information == "test[closed]");
+  REQUIRE(error.information().data() == information.data());
+
+  REQUIRE(ErrorRegistry::Find("test") == Cat());
+  REQUIRE(ErrorRegistry::Find("none") == nullptr);
+}
+
+TEST_CASE("result", "[common]") {
+  static_assert(sizeof(Result<int>) == sizeof(Error) + alignof(Error));
+  static_assert(std::is_nothrow_copy_constructible_v<Result<int>>);
+  static_assert(std::is_nothrow_copy_assignable_v<Result<int>>);
+  static_assert(!std::is_copy_constructible_v<Result<std::unique_ptr<int>>>);
+  static_assert(
+      std::is_nothrow_move_constructible_v<Result<std::unique_ptr<int>>>);
+
+  Result<std::unique_ptr<int>> r{std::make_unique<int>(7)};
+  auto moved = std::move(r);
+  REQUIRE(moved.IsOk());
+  REQUIRE(*moved.PassResult() == 7);
+
+  moved = Err(kTestErrorFailed);
+  REQUIRE(moved.IsError());
+  REQUIRE(moved.GetError().code() == kTestErrorFailed);
+  moved.Clear();
+  REQUIRE(moved.IsEmpty());
+
+  std::vector<Result<std::string>> results(2, std::string{"value"});
+  results.emplace_back(Err(kTestErrorFailed, "failed"));
+  results.resize(10);
+  REQUIRE(results[1].GetResult() == "value");
+  REQUIRE(results[2].GetError().GetMessage() == "failed");
+  REQUIRE(results[9].IsEmpty());
+}
+
+namespace {
+
+struct Payload {
+  static inline int copies = 0;
+  static inline int moves = 0;
+
+  Payload() = default;
+  Payload(const Payload&) { ++copies; }
+  Payload(Payload&&) { ++moves; }
+
+  char data[1024];
+};
+
+Result<int> ParsePayload(Result<Payload>&& r) {
+  Payload p = TRY(std::move(r));
+  UNUSE(p);
+  return 1;
+}
+
+Result<void> Check(bool ok) {
+  if (!ok) return Err(kTestErrorFailed);
+  return {};
+}
+
+Result<int> CheckTwice(bool ok) {
+  TRY(Check(true));
+  TRY(Check(ok));
+  return 2;
+}
+
+}  // namespace
+
+TEST_CASE("result combinators", "[common]") {
+  Payload::copies = Payload::moves = 0;
+
+  Result<Payload> r{Payload{}};
+  REQUIRE(Payload::moves == 1);
+
+  // the payload is passed to |f| by reference, without any move or copy
+  auto size = std::move(r).Map([](Payload&& p) { return sizeof(p.data); });
+  REQUIRE(size.GetResult() == 1024);
+  REQUIRE(Payload::moves == 1);
+
+  auto recover = [](Error&&) -> Result<Payload> { return Payload{}; };
+  auto value = Result<Payload>{Err(kTestErrorFailed)}
+                   .OrElse(recover)
+                   .AndThen([](Payload&&) -> Result<int> { return 3; })
+                   .ValueOr(0);
+  REQUIRE(value == 3);
+  REQUIRE(Payload::moves == 2);
+
+  auto failed = Result<int>{Err(kTestErrorFailed)}
+                    .Map([](int v) { return v + 1; })
+                    .AndThen([](int v) -> Result<void> { return {}; });
+  REQUIRE(failed.GetError().code() == kTestErrorFailed);
+  REQUIRE(Result<int>{Err(kTestErrorFailed)}.ValueOr(5) == 5);
+
+  // moved into the result, and once out of it by TRY
+  Result<Payload> parsed{Payload{}};
+  REQUIRE(Payload::moves == 3);
+  REQUIRE(ParsePayload(std::move(parsed)).GetResult() == 1);
+  REQUIRE(Payload::moves == 4);
+  REQUIRE(!ParsePayload(Err(kTestErrorFailed)));
+  REQUIRE(Payload::copies == 0);
+
+  REQUIRE(CheckTwice(true).GetResult() == 2);
+  REQUIRE(CheckTwice(false).GetError().code() == kTestErrorFailed);
+}
+
+TEST_CASE("histogram", "[common]") {
+  for (std::uint64_t v : {0ull, 7ull, 8ull, 9ull, 1000ull, 123456789ull,
+                          ~0ull}) {
+    auto index = Histogram::IndexOf(v);
+    REQUIRE(index < Histogram::kBuckets);
+    REQUIRE(Histogram::LowerBoundOf(index) <= v);
+    REQUIRE(Histogram::UpperBoundOf(index) >= v);
+  }
+
+  Histogram h;
+  for (std::uint64_t v = 1; v <= 100; ++v) {
+    h.Record(v);
+  }
+  REQUIRE(h.count() == 100);
+  REQUIRE(h.Mean() == 50.5);
+  REQUIRE(h.Min() == 1);
+  REQUIRE(h.ValueAtPercentile(50) >= 50);
+  REQUIRE(h.ValueAtPercentile(50) <= 50 * 9 / 8);
+  REQUIRE(h.ValueAtPercentile(100) >= 100);
+}
+
+namespace {
+
+struct Pooled {
+  explicit Pooled(int v) : value(v) {}
+
+  int value;
+  // a size of its own, not shared with the other pooled objects
+  char padding[412];
+};
+
+struct Counted {
+  explicit Counted(std::vector<int>* d, int v) : destroyed(d), value(v) {}
+  ~Counted() { destroyed->push_back(value); }
+
+  std::vector<int>* destroyed;
+  int value;
+};
+
+}  // namespace
+
+TEST_CASE("object pool", "[common]") {
+  auto object = ObjectPool<Pooled>::New(1);
+  REQUIRE(object->value == 1);
+  ObjectPool<Pooled>::Delete(object);
+
+  // freed by another thread, which flushes them to the depot once it exits
+  std::vector<Pooled*> objects;
+  for (int i = 0; i < 64; ++i) {
+    objects.push_back(ObjectPool<Pooled>::New(i));
+  }
+  std::set<Pooled*> freed(objects.begin(), objects.end());
+  std::thread([&objects]() {
+    for (auto object : objects) {
+      ObjectPool<Pooled>::Delete(object);
+    }
+  }).join();
+
+  std::vector<ObjectPool<Pooled>::UniquePtr> reused;
+  for (int i = 0; i < 64; ++i) {
+    reused.push_back(ObjectPool<Pooled>::MakeUnique(i));
+    REQUIRE(reused.back()->value == i);
+  }
+#if !defined(__SANITIZE_ADDRESS__)
+  REQUIRE(freed.count(reused.back().get()) == 1);
+#endif
+}
+
+TEST_CASE("arena", "[common]") {
+  Arena arena{Arena::Options{4096, false}};
+
+  auto first = arena.Allocate(10, 1);
+  auto aligned = arena.Allocate(64, 64);
+  REQUIRE(reinterpret_cast<std::uintptr_t>(aligned) % 64 == 0);
+  REQUIRE(arena.allocated() == 74);
+
+  // larger than a chunk
+  auto large = static_cast<char*>(arena.Allocate(10000));
+  large[9999] = 1;
+  REQUIRE(arena.reserved() > 10000);
+
+  std::vector<int> destroyed;
+  arena.New<Counted>(&destroyed, 1);
+  arena.New<Counted>(&destroyed, 2);
+  auto text = arena.New<std::string>(100, 'x');
+  REQUIRE(text->size() == 100);
+
+  std::vector<int, ArenaAllocator<int>> v{ArenaAllocator<int>{&arena}};
+  for (int i = 0; i < 1000; ++i) {
+    v.push_back(i);
+  }
+  REQUIRE(v[999] == 999);
+
+  // per request reset, the chunks of the default size are reused
+  auto reserved = arena.reserved();
+  arena.Reset();
+  REQUIRE(destroyed == std::vector<int>{2, 1});
+  REQUIRE(arena.allocated() == 0);
+  REQUIRE(arena.reserved() < reserved);
+
+  reserved = arena.reserved();
+  for (int round = 0; round < 10; ++round) {
+    for (int i = 0; i < 100; ++i) {
+      arena.Allocate(32);
+    }
+    arena.Reset();
+    REQUIRE(arena.reserved() == reserved);
+  }
+  REQUIRE(first != nullptr);
+
+  Arena huge{Arena::Options{Arena::kDefaultChunkSize, true}};
+  auto p = static_cast<char*>(huge.Allocate(1000));
+  p[999] = 1;
+  REQUIRE(huge.reserved() == Arena::kHugePageSize);
+
+  // smaller than a chunk, they share one
+  Arena medium{Arena::Options{4096, false}};
+  medium.Allocate(1500);
+  medium.Allocate(1500);
+  REQUIRE(medium.reserved() == 4096);
+}
+
+}  // namespace base
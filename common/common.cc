@@ -2,27 +2,207 @@
 
 #include <absl/debugging/stacktrace.h>
 #include <absl/debugging/symbolize.h>
-#include <iostream>
+#include <ucontext.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
 namespace base {
+namespace {
 
-std::string GetStackTrace() {
-  static constexpr int kMaxStackDepth = 100;
+constexpr int kMaxStackDepth = 100;
+
+constexpr std::size_t kSymbolCacheBits = 11;
+constexpr std::size_t kSymbolCacheSize = std::size_t{1} << kSymbolCacheBits;
+constexpr std::size_t kMaxProbes = 8;
+
+enum : std::uint32_t {
+  kSymbolEmpty,
+  kSymbolFilling,
+  kSymbolReady,
+  // the pc can not be symbolized, so it's not looked up again
+  kSymbolMissing,
+};
+
+// an entry is claimed by a CAS on |state|, filled, and then published. the
+// readers only look at the published ones, and entries are never evicted, so
+// the lookup is lock free, and so is the insertion, which gives up once the
+// probed entries are all taken.
+struct SymbolEntry {
+  std::atomic<std::uint32_t> state;
+  std::uintptr_t pc;
+  char name[kMaxSymbolLength];
+};
+
+// static storage, zeroed, and never touched before the first lookup
+SymbolEntry g_symbols[kSymbolCacheSize];
+
+std::size_t HashPc(std::uintptr_t pc) {
+  return static_cast<std::size_t>(
+      (static_cast<std::uint64_t>(pc) * 0x9E3779B97F4A7C15ull) >>
+      (64 - kSymbolCacheBits));
+}
+
+void CopyName(const char* name, char* out, std::size_t size) {
+  if (size == 0) {
+    return;
+  }
+  auto length = strnlen(name, size - 1);
+  memcpy(out, name, length);
+  out[length] = '\0';
+}
+
+void FormatAddress(const void* pc, char* out, std::size_t size) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+
+  char tmp[2 + 2 * sizeof(pc) + 1];
+  auto value = reinterpret_cast<std::uintptr_t>(pc);
+  auto end = tmp + sizeof(tmp);
+  auto p = end;
+  *--p = '\0';
+  do {
+    *--p = kDigits[value & 0xf];
+    value >>= 4;
+  } while (value);
+  *--p = 'x';
+  *--p = '0';
+  CopyName(p, out, size);
+}
+
+// the interrupted instruction
+void* GetContextPc(void* context) {
+  auto uc = static_cast<ucontext_t*>(context);
+#if defined(__x86_64__)
+  return reinterpret_cast<void*>(uc->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+  return reinterpret_cast<void*>(uc->uc_mcontext.pc);
+#else
+  UNUSE(uc);
+  return nullptr;
+#endif
+}
+
+}  // namespace
+
+bool Symbolize(const void* pc, char* out, std::size_t size) {
+  if (size == 0) {
+    return false;
+  }
+
+  auto key = reinterpret_cast<std::uintptr_t>(pc);
+  auto index = HashPc(key);
 
+  SymbolEntry* empty = nullptr;
+  for (std::size_t i = 0; i < kMaxProbes; ++i) {
+    auto& entry = g_symbols[(index + i) & (kSymbolCacheSize - 1)];
+    auto state = entry.state.load(std::memory_order_acquire);
+    if (state == kSymbolReady && entry.pc == key) {
+      CopyName(entry.name, out, size);
+      return true;
+    }
+    if (state == kSymbolMissing && entry.pc == key) {
+      return false;
+    }
+    if (state == kSymbolEmpty) {
+      empty = &entry;
+      break;
+    }
+  }
+
+  char name[kMaxSymbolLength];
+  auto found = absl::Symbolize(pc, name, sizeof(name));
+
+  std::uint32_t expected = kSymbolEmpty;
+  if (empty && empty->state.compare_exchange_strong(
+                   expected, kSymbolFilling, std::memory_order_acquire)) {
+    empty->pc = key;
+    if (found) {
+      memcpy(empty->name, name, sizeof(name));
+    }
+    empty->state.store(found ? kSymbolReady : kSymbolMissing,
+                       std::memory_order_release);
+  }
+
+  if (!found) {
+    return false;
+  }
+  CopyName(name, out, size);
+  return true;
+}
+
+std::size_t SymbolizeStackTrace(void* const* frames, int depth, char* buffer,
+                                std::size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+
+  std::size_t length = 0;
+  for (auto i = 0; i < depth && length + 1 < size; ++i) {
+    char name[kMaxSymbolLength];
+    if (!Symbolize(frames[i], name, sizeof(name))) {
+      FormatAddress(frames[i], name, sizeof(name));
+    }
+
+    auto n = strnlen(name, sizeof(name));
+    n = std::min(n, size - 1 - length);
+    memcpy(buffer + length, name, n);
+    length += n;
+    if (length + 1 < size) {
+      buffer[length++] = '\n';
+    }
+  }
+
+  buffer[length] = '\0';
+  return length;
+}
+
+std::size_t GetStackTrace(char* buffer, std::size_t size) {
+  void* frames[kMaxStackDepth];
+  int depth = absl::GetStackTrace(frames, kMaxStackDepth, 1);
+
+  return SymbolizeStackTrace(frames, depth, buffer, size);
+}
+
+int GetSignalStackTrace(void* context, void** frames, int max_depth) {
+  max_depth = std::min(max_depth, kMaxStackDepth);
+  if (max_depth <= 0) {
+    return 0;
+  }
+
+  // the interrupted function is missing from the unwound frames, which start
+  // from its caller once this function and the handler are skipped
+  int depth = 0;
+  if (auto pc = GetContextPc(context)) {
+    frames[depth++] = pc;
+  }
   int sizes[kMaxStackDepth];
-  void* result[kMaxStackDepth];
-  int depth = absl::GetStackFrames(result, sizes, kMaxStackDepth, 1);
+  depth += absl::GetStackFramesWithContext(frames + depth, sizes,
+                                           max_depth - depth, 2, context,
+                                           nullptr);
+  return depth;
+}
 
+std::string GetStackTrace() {
+  void* frames[kMaxStackDepth];
+  int depth = absl::GetStackTrace(frames, kMaxStackDepth, 1);
+
+  return SymbolizeStackTrace(frames, depth);
+}
+
+std::string SymbolizeStackTrace(void* const* frames, int depth) {
   std::string bt;
   for (auto i = 0; i < depth; ++i) {
-    char tmp[1024];
-    if(absl::Symbolize(result[i], tmp, sizeof(tmp))) {
-      bt.append(tmp);
+    char name[kMaxSymbolLength];
+    if (!Symbolize(frames[i], name, sizeof(name))) {
+      FormatAddress(frames[i], name, sizeof(name));
     }
+    bt.append(name);
+    bt.push_back('\n');
   }
 
   return bt;
 }
 
-
 }  // namespace base
-
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdarg>
+#include <cstddef>
 #include <cstdlib>
 #include <exception>
 #include <optional>
@@ -30,18 +31,44 @@
 
 namespace base {
 
+// the longer symbols are truncated
+constexpr std::size_t kMaxSymbolLength = 256;
+
 std::string GetStackTrace();
 
+// one line per frame, the frames which can not be symbolized are printed as
+// addresses
+std::string SymbolizeStackTrace(void* const* frames, int depth);
+
+// the functions below are async-signal-safe, they neither allocate nor lock.
+// the symbols are cached once resolved, and so are the pcs which can not be.
+
+// symbolize |pc| into |out|, false if it can not be symbolized, or |size| is
+// zero
+bool Symbolize(const void* pc, char* out, std::size_t size);
+
+// same as above, but written into |buffer| which is always NUL terminated, the
+// trace is truncated if it does not fit. returns the length written.
+std::size_t GetStackTrace(char* buffer, std::size_t size);
+std::size_t SymbolizeStackTrace(void* const* frames, int depth, char* buffer,
+                                std::size_t size);
+
+// the frames interrupted by a signal, from the interrupted instruction, for a
+// handler installed with |SA_SIGINFO| and given the |context| it receives
+int GetSignalStackTrace(void* context, void** frames, int max_depth);
+
 [[noreturn]] inline void DieNow() noexcept { std::abort(); }
 [[noreturn]] inline void Die() noexcept {
-  fmt::fprintf(stderr, "bt: \n{}\n", GetStackTrace());
+  char bt[16 * 1024];
+  GetStackTrace(bt, sizeof(bt));
+  fmt::fprintf(stderr, "bt: \n%s\n", bt);
   DieNow();
 }
 
 template <typename... ARGS>
 [[noreturn]] inline void Die(const char* fmt, const ARGS&... args) {
   auto msg = fmt::format(fmt, args...);
-  fmt::fprintf(stderr, "[die]: {}", msg);
+  fmt::print(stderr, "[die]: {}\n", msg);
   Die();
 }
 
@@ -52,9 +79,9 @@ R ExceptionRun(F&& h, const char* expr, const char* file, int line) {
   try {
     return h();
   } catch (std::exception& e) {
-    Die("%s.%d]: %s thrown exception %s", file, line, expr, e.what());
+    Die("{}:{}: {} thrown exception {}", file, line, expr, e.what());
   } catch (...) {
-    Die("%s.%d]: %s thrown unknown exception", file, line, expr);
+    Die("{}:{}: {} thrown unknown exception", file, line, expr);
   }
 }
 
@@ -0,0 +1,319 @@
+#include "crash-handler.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include "check.h"
+#include "common.h"
+
+namespace base {
+namespace {
+
+constexpr int kFatalSignals[] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE};
+constexpr std::size_t kFatalSignalCount =
+    sizeof(kFatalSignals) / sizeof(kFatalSignals[0]);
+
+constexpr int kMaxDepth = 64;
+constexpr std::size_t kAltStackSize = 64 * 1024;
+// how long a thread is waited for to capture its own stack
+constexpr int kDumpTimeoutMs = 100;
+
+int g_fd = STDERR_FILENO;
+// the signal interrupting the other threads to capture their stacks
+int g_dump_signal = 0;
+struct sigaction g_previous[kFatalSignalCount];
+
+// the thread reporting a crash, the others hitting a fatal signal meanwhile
+// wait for it
+std::atomic<pid_t> g_crashing{0};
+std::atomic<bool> g_reported{false};
+
+// the stack of another thread, captured by itself in the dump handler
+struct ThreadCapture {
+  enum State : int {
+    kIdle,
+    kRequested,
+    kCapturing,
+    kDone,
+  };
+
+  std::atomic<int> state{kIdle};
+  std::atomic<pid_t> tid{0};
+  void* frames[kMaxDepth];
+  int depth{0};
+};
+
+ThreadCapture g_capture;
+
+// used by the reporting thread only
+char g_trace[32 * 1024];
+char g_dirents[4096];
+
+struct Dirent64 {
+  std::uint64_t d_ino;
+  std::int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+
+pid_t GetTid() { return static_cast<pid_t>(syscall(SYS_gettid)); }
+
+void SleepMs(long ms) {
+  struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+  }
+}
+
+void Write(const char* text, std::size_t size) {
+  while (size > 0) {
+    auto n = write(g_fd, text, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    text += n;
+    size -= static_cast<std::size_t>(n);
+  }
+}
+
+void Write(const char* text) { Write(text, strlen(text)); }
+
+void WriteNumber(std::uint64_t value, bool hex = false) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+
+  char tmp[32];
+  auto p = tmp + sizeof(tmp);
+  auto base = hex ? 16 : 10;
+  do {
+    *--p = kDigits[value % base];
+    value /= base;
+  } while (value);
+  if (hex) {
+    *--p = 'x';
+    *--p = '0';
+  }
+  Write(p, static_cast<std::size_t>(tmp + sizeof(tmp) - p));
+}
+
+void WriteTrace(void* const* frames, int depth) {
+  auto length = SymbolizeStackTrace(frames, depth, g_trace, sizeof(g_trace));
+  Write(g_trace, length);
+}
+
+const char* SignalName(int signo) {
+  switch (signo) {
+    case SIGSEGV:
+      return "SIGSEGV";
+    case SIGBUS:
+      return "SIGBUS";
+    case SIGABRT:
+      return "SIGABRT";
+    case SIGFPE:
+      return "SIGFPE";
+    default:
+      return "signal";
+  }
+}
+
+void OnDumpSignal(int, siginfo_t*, void* context) {
+  auto saved_errno = errno;
+
+  int requested = ThreadCapture::kRequested;
+  if (g_capture.tid.load(std::memory_order_acquire) == GetTid() &&
+      g_capture.state.compare_exchange_strong(requested,
+                                              ThreadCapture::kCapturing,
+                                              std::memory_order_acquire)) {
+    g_capture.depth = GetSignalStackTrace(context, g_capture.frames, kMaxDepth);
+    g_capture.state.store(ThreadCapture::kDone, std::memory_order_release);
+  }
+
+  errno = saved_errno;
+}
+
+void DumpThread(pid_t tid) {
+  Write("\n*** thread ");
+  WriteNumber(static_cast<std::uint64_t>(tid));
+  Write(" ***\n");
+
+  g_capture.depth = 0;
+  g_capture.tid.store(tid, std::memory_order_release);
+  g_capture.state.store(ThreadCapture::kRequested, std::memory_order_release);
+  if (syscall(SYS_tgkill, getpid(), tid, g_dump_signal) != 0) {
+    g_capture.state.store(ThreadCapture::kIdle, std::memory_order_relaxed);
+    Write("(exited)\n");
+    return;
+  }
+
+  for (int waited = 0;; ++waited) {
+    auto state = g_capture.state.load(std::memory_order_acquire);
+    if (state == ThreadCapture::kDone) {
+      WriteTrace(g_capture.frames, g_capture.depth);
+      break;
+    }
+
+    // blocked with the signal masked, withdraw unless it's capturing
+    if (state == ThreadCapture::kRequested && waited >= kDumpTimeoutMs) {
+      int requested = ThreadCapture::kRequested;
+      if (g_capture.state.compare_exchange_strong(
+              requested, ThreadCapture::kIdle, std::memory_order_relaxed)) {
+        Write("(not responding)\n");
+        return;
+      }
+      continue;
+    }
+    SleepMs(1);
+  }
+  g_capture.state.store(ThreadCapture::kIdle, std::memory_order_relaxed);
+}
+
+void DumpOtherThreads(pid_t self) {
+  int fd = open("/proc/self/task", O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    return;
+  }
+
+  for (;;) {
+    auto n = syscall(SYS_getdents64, fd, g_dirents, sizeof(g_dirents));
+    if (n <= 0) {
+      break;
+    }
+
+    for (long pos = 0; pos < n;) {
+      auto entry = reinterpret_cast<const Dirent64*>(g_dirents + pos);
+      pos += entry->d_reclen;
+
+      pid_t tid = 0;
+      auto name = entry->d_name;
+      for (; *name >= '0' && *name <= '9'; ++name) {
+        tid = tid * 10 + (*name - '0');
+      }
+      if (*name == '\0' && tid != 0 && tid != self) {
+        DumpThread(tid);
+      }
+    }
+  }
+
+  close(fd);
+}
+
+// hand the signal over to the previous handler, or the default action, once
+// this handler returns
+void Reraise(int signo) {
+  for (std::size_t i = 0; i < kFatalSignalCount; ++i) {
+    if (kFatalSignals[i] != signo) {
+      continue;
+    }
+
+    auto previous = g_previous[i];
+    if (!(previous.sa_flags & SA_SIGINFO) &&
+        previous.sa_handler == SIG_IGN) {
+      previous.sa_handler = SIG_DFL;
+    }
+    sigaction(signo, &previous, nullptr);
+  }
+  raise(signo);
+}
+
+void OnFatalSignal(int signo, siginfo_t* info, void* context) {
+  auto tid = GetTid();
+
+  pid_t crashing = 0;
+  if (!g_crashing.compare_exchange_strong(crashing, tid)) {
+    // another thread is reporting, or the handler itself has crashed
+    if (crashing != tid) {
+      for (int i = 0; i < 100 && !g_reported.load(); ++i) {
+        SleepMs(50);
+      }
+    }
+    Reraise(signo);
+    return;
+  }
+
+  Write("*** ");
+  Write(SignalName(signo));
+  Write(" received");
+  if (signo != SIGABRT) {
+    Write(" at ");
+    WriteNumber(reinterpret_cast<std::uintptr_t>(info->si_addr), true);
+  }
+  Write(" by thread ");
+  WriteNumber(static_cast<std::uint64_t>(tid));
+  Write(" ***\n");
+
+  void* frames[kMaxDepth];
+  WriteTrace(frames, GetSignalStackTrace(context, frames, kMaxDepth));
+
+  DumpOtherThreads(tid);
+  g_reported.store(true);
+
+  Reraise(signo);
+}
+
+}  // namespace
+
+void InstallCrashHandler(int fd) {
+  static std::once_flag once;
+  std::call_once(once, [fd]() {
+    g_fd = fd;
+    g_dump_signal = SIGRTMIN + 3;
+
+    struct sigaction dump = {};
+    dump.sa_sigaction = OnDumpSignal;
+    dump.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+    sigemptyset(&dump.sa_mask);
+    CHECK(sigaction(g_dump_signal, &dump, nullptr) == 0);
+
+    for (std::size_t i = 0; i < kFatalSignalCount; ++i) {
+      struct sigaction action = {};
+      action.sa_sigaction = OnFatalSignal;
+      action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+      sigemptyset(&action.sa_mask);
+      CHECK(sigaction(kFatalSignals[i], &action, &g_previous[i]) == 0);
+    }
+  });
+
+  InstallCrashStack();
+}
+
+void InstallCrashStack() {
+  thread_local struct AltStack {
+    std::unique_ptr<char[]> memory;
+
+    ~AltStack() {
+      if (memory) {
+        stack_t disable = {};
+        disable.ss_flags = SS_DISABLE;
+        sigaltstack(&disable, nullptr);
+      }
+    }
+  } alt;
+
+  // keep the one installed already, e.g. by a sanitizer
+  stack_t current = {};
+  if (alt.memory || sigaltstack(nullptr, &current) != 0 ||
+      !(current.ss_flags & SS_DISABLE)) {
+    return;
+  }
+
+  alt.memory.reset(new char[kAltStackSize]);
+  stack_t stack = {};
+  stack.ss_sp = alt.memory.get();
+  stack.ss_size = kAltStackSize;
+  if (sigaltstack(&stack, nullptr) != 0) {
+    alt.memory.reset();
+  }
+}
+
+}  // namespace base
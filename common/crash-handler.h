@@ -0,0 +1,25 @@
+#pragma once
+
+#include <unistd.h>
+
+namespace base {
+
+// |InstallCrashHandler| reports the fatal signals, SIGSEGV, SIGBUS, SIGABRT
+// and SIGFPE. the symbolized stack of the faulting thread is written to |fd|,
+// then the ones of the other threads, which are interrupted one after another
+// by SIGRTMIN + 3 to capture their own. the signal is re-raised afterwards, to
+// the handler installed before, or the default action, which dumps the core.
+//
+// everything runs in the handler with preallocated buffers, and without any
+// lock or allocation. it's installed once, the later calls are ignored.
+void InstallCrashHandler(int fd = STDERR_FILENO);
+
+// run the crash handler of the calling thread on an alternate stack, so that
+// a stack overflow is reported as well. it can't be done lazily once the
+// stack has overflowed, so every thread has to call it when it starts.
+// |InstallCrashHandler| does it for the thread calling it, and the workers of
+// |ThreadPoolExecutor| and |ExecutorGroup| for themselves. the stack is freed
+// once the thread exits.
+void InstallCrashStack();
+
+}  // namespace base
@@ -0,0 +1,279 @@
+#include "error.h"
+
+#include <absl/debugging/stacktrace.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "common.h"
+#include "no-destructor.h"
+
+namespace base {
+namespace _ {
+
+// the strings are interned, so they outlive the table
+struct ErrorInformation {
+  std::unordered_map<std::uint32_t, std::string_view> strings;
+};
+
+}  // namespace _
+
+namespace {
+
+// the interned strings are never freed, the nodes of |std::unordered_set|
+// keep their address on rehash.
+struct InternTable {
+  std::mutex mutex;
+  std::unordered_set<std::string> strings;
+};
+
+// |TableReaders| counts the threads reading a published table, striped so the
+// readers of different threads rarely share a cache line. a table replaced
+// before the counters are all seen zero is read by nobody any more, a reader
+// entering later loads the replacing one.
+class TableReaders {
+ public:
+  std::atomic<std::uint32_t>* Enter() {
+    auto count = &stripes_[Index()].count;
+    count->fetch_add(1, std::memory_order_seq_cst);
+    return count;
+  }
+
+  static void Leave(std::atomic<std::uint32_t>* count) {
+    count->fetch_sub(1, std::memory_order_release);
+  }
+
+  bool IsQuiescent() const {
+    for (auto& stripe : stripes_) {
+      if (stripe.count.load(std::memory_order_seq_cst) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  static constexpr std::size_t kStripes = 16;
+
+  struct alignas(64) Stripe {
+    std::atomic<std::uint32_t> count{0};
+  };
+
+  static std::size_t Index() {
+    thread_local std::size_t index =
+        std::hash<std::thread::id>{}(std::this_thread::get_id()) % kStripes;
+    return index;
+  }
+
+  Stripe stripes_[kStripes];
+};
+
+// a memoized code which is not registered, the slot is taken once and never
+// evicted, so the string handed out stays valid. |category| is stored last.
+struct UnregisteredSlot {
+  std::atomic<const Error::Category*> category{nullptr};
+  std::uint32_t code{0};
+  std::string_view text;
+
+  bool Holds(const Error::Category* c, std::uint32_t k) const {
+    return category.load(std::memory_order_acquire) == c && code == k;
+  }
+};
+
+struct Registry {
+  static constexpr std::size_t kUnregisteredSlots = 1024;
+  static constexpr std::size_t kMaxProbes = 16;
+
+  std::mutex mutex;
+  std::unordered_map<std::string, const Error::Category*> categories;
+
+  // the replaced tables, freed once no reader may still hold them
+  std::vector<std::unique_ptr<const _::ErrorInformation>> retired;
+  TableReaders readers;
+
+  // open addressing by linear probing, a code which finds no free slot is
+  // formatted on each lookup
+  UnregisteredSlot unregistered[kUnregisteredSlots];
+
+  static std::size_t Hash(const Error::Category* category,
+                          std::uint32_t code) {
+    auto h = reinterpret_cast<std::uintptr_t>(category) >> 4;
+    return (h ^ (code * std::size_t{0x9e3779b1})) % kUnregisteredSlots;
+  }
+
+  // a free slot is returned if |code| is not memoized yet, or nullptr
+  UnregisteredSlot* Probe(const Error::Category* category, std::uint32_t code) {
+    auto h = Hash(category, code);
+    for (std::size_t i = 0; i < kMaxProbes; ++i) {
+      auto slot = &unregistered[(h + i) % kUnregisteredSlots];
+      auto c = slot->category.load(std::memory_order_acquire);
+      if (!c || (c == category && slot->code == code)) {
+        return slot;
+      }
+    }
+    return nullptr;
+  }
+};
+
+Registry* GetRegistry() {
+  static NoDestructor<Registry> registry;
+  return registry.get();
+}
+
+std::string_view Intern(std::string_view text) {
+  return Error::StaticMessage::Intern(text).text();
+}
+
+}  // namespace
+
+Error::StaticMessage Error::StaticMessage::Intern(std::string_view text) {
+  static NoDestructor<InternTable> table;
+
+  std::lock_guard<std::mutex> lock(table->mutex);
+  auto it = table->strings.emplace(text).first;
+  return StaticMessage{it->c_str()};
+}
+
+void Error::CaptureStack() {
+  thread_local std::uint32_t countdown = 0;
+  if (countdown != 0) {
+    --countdown;
+    return;
+  }
+  auto every = stack_sampling_.load(std::memory_order_relaxed);
+  if (every == 0) {
+    return;
+  }
+  countdown = every - 1;
+
+  auto stack = std::make_unique<_::ErrorStack>();
+  int sizes[_::ErrorStack::kMaxDepth];
+  stack->depth =
+      absl::GetStackFrames(stack->frames, sizes, _::ErrorStack::kMaxDepth, 1);
+
+  if (kind_ != kShared) {
+    auto msg = new _::StaticErrorMessage(kind_ == kStatic ? static_ : nullptr);
+    shared_ = msg;
+    kind_ = kShared;
+  }
+  shared_->stack = std::move(stack);
+}
+
+std::string Error::GetStackTrace() const {
+  if (!HasStackTrace()) {
+    return {};
+  }
+  return SymbolizeStackTrace(shared_->stack->frames, shared_->stack->depth);
+}
+
+std::string Error::ToString() const {
+  if (!Has()) {
+    return "ok";
+  }
+
+  std::string text{information()};
+  if (HasMessage()) {
+    text.append(": ").append(GetMessage());
+  }
+  if (HasStackTrace()) {
+    text.append("\n").append(GetStackTrace());
+  }
+  return text;
+}
+
+// copy on write, the readers of the current table are never blocked. the
+// replaced one is retired, and freed once it's read by nobody.
+const _::ErrorInformation* ErrorRegistry::Publish(
+    const Error::Category* category, const std::uint32_t* codes,
+    std::size_t count) {
+  auto registry = GetRegistry();
+  auto table = std::make_unique<_::ErrorInformation>();
+  auto current = category->information_.load(std::memory_order_relaxed);
+  if (current) {
+    table->strings = current->strings;
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    if (!table->strings.count(codes[i])) {
+      table->strings.emplace(codes[i],
+                             Intern(category->GetInformation(codes[i])));
+    }
+  }
+
+  auto published = table.release();
+  category->information_.store(published, std::memory_order_seq_cst);
+  if (current) {
+    registry->retired.emplace_back(current);
+  }
+  if (registry->readers.IsQuiescent()) {
+    registry->retired.clear();
+  }
+  return published;
+}
+
+void ErrorRegistry::Register(const Error::Category* category,
+                             std::initializer_list<std::uint32_t> codes) {
+  DCHECK(category);
+  auto registry = GetRegistry();
+
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  auto it = registry->categories.emplace(category->GetName(), category).first;
+  DCHECK(it->second == category);
+
+  Publish(category, codes.begin(), codes.size());
+}
+
+const Error::Category* ErrorRegistry::Find(std::string_view name) {
+  auto registry = GetRegistry();
+
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  auto it = registry->categories.find(std::string{name});
+  return it == registry->categories.end() ? nullptr : it->second;
+}
+
+std::string_view ErrorRegistry::GetInformation(const Error::Category* category,
+                                               std::uint32_t code) {
+  DCHECK(category);
+  auto registry = GetRegistry();
+  {
+    std::optional<std::string_view> text;
+    auto readers = registry->readers.Enter();
+    if (auto table = category->information_.load(std::memory_order_seq_cst)) {
+      auto it = table->strings.find(code);
+      if (it != table->strings.end()) {
+        text = it->second;
+      }
+    }
+    TableReaders::Leave(readers);
+    if (text) {
+      return *text;
+    }
+  }
+
+  // not registered, memoized aside instead of republishing the table
+  auto slot = registry->Probe(category, code);
+  if (slot && slot->Holds(category, code)) {
+    return slot->text;
+  }
+
+  auto text = Intern(category->GetInformation(code));
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  slot = registry->Probe(category, code);
+  if (!slot) {
+    return text;
+  }
+  if (!slot->category.load(std::memory_order_relaxed)) {
+    slot->code = code;
+    slot->text = text;
+    slot->category.store(category, std::memory_order_release);
+  }
+  return slot->text;
+}
+
+}  // namespace base
@@ -1,73 +1,339 @@
 #pragma once
 
-#include <optional>
+#include <fmt/format.h>
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 #include "check.h"
+#include "macros.h"
 
 namespace base {
+namespace _ {
+
+struct ErrorInformation;
+
+// the raw PCs of where an |Error| was created
+struct ErrorStack {
+  static constexpr int kMaxDepth = 16;
+
+  void* frames[kMaxDepth];
+  int depth{0};
+};
+
+// |ErrorMessage| is the shared, ref-counted message of |Error|s. it's immutable
+// once created, so the copies of an error share it across threads.
+class ErrorMessage {
+ public:
+  virtual ~ErrorMessage() {}
+
+  // false if the node only carries the stack
+  virtual bool HasText() const { return true; }
+  virtual std::string Format() const = 0;
+
+  // move the text out if this is the last reference
+  virtual std::string Pass() { return Format(); }
+
+  void Ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+  bool Unref() { return refs_.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+  bool IsUnique() const { return refs_.load(std::memory_order_acquire) == 1; }
+
+  // set only while the error is being created
+  std::unique_ptr<ErrorStack> stack;
+
+ private:
+  std::atomic<std::uint32_t> refs_{1};
+};
+
+// a static message, or none, along with a sampled stack
+class StaticErrorMessage : public ErrorMessage {
+ public:
+  explicit StaticErrorMessage(const char* text) : text_(text) {}
+
+  bool HasText() const override { return text_ != nullptr; }
+  std::string Format() const override { return text_; }
+
+ private:
+  const char* text_;
+};
+
+class StringErrorMessage : public ErrorMessage {
+ public:
+  explicit StringErrorMessage(std::string text) : text_(std::move(text)) {}
+
+  std::string Format() const override { return text_; }
+  std::string Pass() override {
+    return IsUnique() ? std::move(text_) : text_;
+  }
+
+ private:
+  std::string text_;
+};
+
+// the arguments are captured by value, strings referenced by |const char*| or
+// |std::string_view| are copied, since they may not outlive the error.
+template <typename T, typename D = std::decay_t<T>>
+using LazyArg = std::conditional_t<std::is_same_v<D, const char*> ||
+                                       std::is_same_v<D, char*> ||
+                                       std::is_same_v<D, std::string_view>,
+                                   std::string, D>;
+
+// the format is referenced instead of copied, it's a literal like the
+// message of |Error::StaticMessage|
+template <typename... Args>
+class LazyErrorMessage : public ErrorMessage {
+ public:
+  template <typename... T>
+  LazyErrorMessage(const char* format, T&&... args)
+      : format_(format), args_(std::forward<T>(args)...) {}
+
+  std::string Format() const override {
+    return std::apply(
+        [this](const Args&... args) {
+          return fmt::vformat(format_, fmt::make_format_args(args...));
+        },
+        args_);
+  }
+
+ private:
+  std::string_view format_;
+  std::tuple<Args...> args_;
+};
 
+}  // namespace _
+
+// |Error| is a category, a code and an optional message, in three words. the
+// message is either a static string, which is never freed, or a ref-counted
+// one shared by the copies. an error without message, or with a static one,
+// never allocates.
 class Error {
  public:
   class Category {
    public:
     virtual const char* GetName() const = 0;
+    // called once per code by |ErrorRegistry|, use |Error::information| instead
     virtual std::string GetInformation(std::uint32_t) const = 0;
 
     virtual ~Category() {}
+
+   private:
+    // the information cached by |ErrorRegistry|, it's immutable once
+    // published, and freed once replaced and read by nobody
+    mutable std::atomic<const _::ErrorInformation*> information_{nullptr};
+
+    friend class ErrorRegistry;
+  };
+
+  // |StaticMessage| references a string which outlives every error, like a
+  // string literal, or one returned by |Intern|
+  class StaticMessage {
+   public:
+    constexpr explicit StaticMessage(const char* text) : text_(text) {}
+
+    // copy |text| into a process wide table once, the same text is always
+    // interned to the same string.
+    static StaticMessage Intern(std::string_view text);
+
+    const char* text() const { return text_; }
+
+   private:
+    const char* text_;
   };
 
   static constexpr std::uint32_t kNoErrorCode = 0;
 
  public:
-  Error() : code_(kNoErrorCode), category_(nullptr), message_() {}
+  Error() = default;
   Error(const Category* category, std::uint32_t code)
-      : code_(code), category_(category), message_() {}
+      : category_(category), code_(code) {
+    MaybeCaptureStack();
+  }
+  Error(const Category* category, std::uint32_t code, StaticMessage msg)
+      : category_(category),
+        code_(code),
+        kind_(msg.text() ? kStatic : kNone),
+        static_(msg.text()) {
+    MaybeCaptureStack();
+  }
   Error(const Category* category, std::uint32_t code, const std::string& msg)
-      : code_(code), category_(category), message_(msg) {}
+      : Error(category, code, new _::StringErrorMessage(msg)) {}
   Error(const Category* category, std::uint32_t code, std::string&& msg)
-      : code_(code), category_(category), message_(std::move(msg)) {}
+      : Error(category, code, new _::StringErrorMessage(std::move(msg))) {}
 
-  Error(Error&&) = default;
-  Error(const Error&) = default;
-  Error& operator=(Error&&) = default;
-  Error& operator=(const Error&) = default;
+  // the message is formatted from |format| and |args| only when it's read.
+  // the arguments are copied, but |format| is referenced, it must outlive
+  // the error like a string literal.
+  template <typename... Args>
+  static Error Lazy(const Category* category, std::uint32_t code,
+                    const char* format, Args&&... args) {
+    using Message = _::LazyErrorMessage<_::LazyArg<Args>...>;
+    return Error{category, code,
+                 new Message(format, std::forward<Args>(args)...)};
+  }
+
+  // the moved-from error keeps its category and code, the message is stolen
+  Error(Error&& other) noexcept
+      : category_(other.category_), code_(other.code_), kind_(other.kind_) {
+    Steal(&other);
+  }
+  Error(const Error& other) noexcept
+      : category_(other.category_), code_(other.code_), kind_(other.kind_) {
+    if (kind_ == kShared) {
+      shared_ = other.shared_;
+      shared_->Ref();
+    } else {
+      static_ = other.static_;
+    }
+  }
+  Error& operator=(Error&& other) noexcept {
+    if (this != &other) {
+      Release();
+      category_ = other.category_;
+      code_ = other.code_;
+      kind_ = other.kind_;
+      Steal(&other);
+    }
+    return *this;
+  }
+  Error& operator=(const Error& other) {
+    if (this != &other) {
+      *this = Error{other};
+    }
+    return *this;
+  }
+  ~Error() { Release(); }
 
  public:
   std::uint32_t code() const { return code_; }
   const Category* category() const { return category_; }
-  std::string information() const { return category_->GetInformation(code_); }
+  inline std::string_view information() const;
 
   bool Has() const { return category_ != nullptr; }
   operator bool() const { return Has(); }
 
-  bool HasMessage() const { return message_.has_value(); }
+  bool HasMessage() const {
+    return kind_ == kStatic || (kind_ == kShared && shared_->HasText());
+  }
+  // the sampled stack goes along with the message
   inline std::string PassMessage();
   inline std::string GetMessage() const;
 
   inline void Clear();
 
+ public:
+  // capture the stack of 1 in |every| errors created by each thread, 0 turns
+  // it off, which is the default. only the raw PCs are captured.
+  static void SetStackSampling(std::uint32_t every) {
+    stack_sampling_.store(every, std::memory_order_relaxed);
+  }
+
+  bool HasStackTrace() const { return kind_ == kShared && shared_->stack; }
+  // symbolized on each call, one frame per line
+  std::string GetStackTrace() const;
+
+  // the information, the message and the stack trace, for logging
+  std::string ToString() const;
+
  private:
-  std::uint32_t code_;
-  const Category* category_;
-  std::optional<std::string> message_;
+  enum Kind : std::uint8_t { kNone, kStatic, kShared };
+
+  Error(const Category* category, std::uint32_t code, _::ErrorMessage* msg)
+      : category_(category), code_(code), kind_(kShared), shared_(msg) {
+    MaybeCaptureStack();
+  }
+
+  void MaybeCaptureStack() {
+    if (UNLIKELY(stack_sampling_.load(std::memory_order_relaxed) != 0)) {
+      CaptureStack();
+    }
+  }
+  void CaptureStack();
+
+  void Steal(Error* other) {
+    if (kind_ == kShared) {
+      shared_ = other->shared_;
+    } else {
+      static_ = other->static_;
+    }
+    other->kind_ = kNone;
+  }
+
+  void Release() {
+    if (kind_ == kShared && shared_->Unref()) {
+      delete shared_;
+    }
+    kind_ = kNone;
+  }
+
+ private:
+  const Category* category_{nullptr};
+  std::uint32_t code_{kNoErrorCode};
+  // lives in the padding after |code_|, and tags the message below
+  Kind kind_{kNone};
+  union {
+    const char* static_{nullptr};
+    _::ErrorMessage* shared_;
+  };
+
+  static inline std::atomic<std::uint32_t> stack_sampling_{0};
+};
+
+static_assert(sizeof(Error) <= 2 * sizeof(void*) + 8, "error isn't compact");
+
+// |ErrorRegistry| is the process wide table of the error categories. the
+// information of each registered code is formatted once, and kept for the
+// lifetime of the process, so it's read without any lock or allocation.
+class ErrorRegistry {
+ public:
+  // register |category| under its name, with the information of |codes|. it
+  // can be called again to add more codes.
+  static void Register(const Error::Category* category,
+                       std::initializer_list<std::uint32_t> codes);
+
+  // nullptr if no category has been registered with |name|
+  static const Error::Category* Find(std::string_view name);
+
+  // the codes which are not registered are formatted on the first call, and
+  // memoized in a fixed number of slots aside. once they are taken, the
+  // information of another code is formatted on each call.
+  static std::string_view GetInformation(const Error::Category* category,
+                                         std::uint32_t code);
+
+ private:
+  // publish a copy of the table of |category| with |codes| added, and retire
+  // the replaced one. it must be called with the registry lock held
+  static const _::ErrorInformation* Publish(const Error::Category* category,
+                                            const std::uint32_t* codes,
+                                            std::size_t count);
 };
 
+inline std::string_view Error::information() const {
+  return ErrorRegistry::GetInformation(category_, code_);
+}
+
 inline void Error::Clear() {
+  Release();
   category_ = nullptr;
-  message_.reset();
   code_ = kNoErrorCode;
 }
 
 inline std::string Error::GetMessage() const {
   DCHECK(HasMessage());
-  return message_.value();
+  return kind_ == kShared ? shared_->Format() : std::string{static_};
 }
 
 inline std::string Error::PassMessage() {
   DCHECK(HasMessage());
-  return std::move(*message_);
+  auto text = kind_ == kShared ? shared_->Pass() : std::string{static_};
+  Release();
+  return text;
 }
 
 }  // namespace base
-
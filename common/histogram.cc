@@ -0,0 +1,73 @@
+#include "histogram.h"
+
+#include <cmath>
+
+namespace base {
+
+std::uint64_t Histogram::LowerBoundOf(std::size_t index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  std::size_t shift = index / kSubBuckets - 1;
+  std::uint64_t top = index % kSubBuckets + kSubBuckets;
+  return top << shift;
+}
+
+std::uint64_t Histogram::UpperBoundOf(std::size_t index) {
+  if (index + 1 == kBuckets) {
+    return UINT64_MAX;
+  }
+  return LowerBoundOf(index + 1) - 1;
+}
+
+void Histogram::Merge(const Histogram& other) {
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+}
+
+double Histogram::Mean() const {
+  return count_ ? static_cast<double>(sum_) / count_ : 0.0;
+}
+
+std::uint64_t Histogram::Min() const {
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    if (buckets_[i]) {
+      return LowerBoundOf(i);
+    }
+  }
+  return 0;
+}
+
+std::uint64_t Histogram::Max() const {
+  for (std::size_t i = kBuckets; i > 0; --i) {
+    if (buckets_[i - 1]) {
+      return UpperBoundOf(i - 1);
+    }
+  }
+  return 0;
+}
+
+std::uint64_t Histogram::ValueAtPercentile(double percentile) const {
+  if (count_ == 0) {
+    return 0;
+  }
+
+  auto rank = static_cast<std::uint64_t>(std::ceil(percentile / 100 * count_));
+  if (rank == 0) {
+    rank = 1;
+  }
+
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return UpperBoundOf(i);
+    }
+  }
+  return Max();
+}
+
+}  // namespace base
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace base {
+
+// |Histogram| is a log-linear histogram in the style of HdrHistogram, every
+// power of two range is split into |kSubBuckets| linear buckets, so that the
+// relative error of a recorded value is within 1/|kSubBuckets|. it covers
+// the whole uint64_t range in a fixed array, recording is an index
+// computation plus an increment.
+class Histogram {
+ public:
+  static constexpr std::size_t kSubBucketBits = 3;
+  static constexpr std::size_t kSubBuckets = 1 << kSubBucketBits;
+  static constexpr std::size_t kBuckets =
+      (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  static std::size_t IndexOf(std::uint64_t value) {
+    if (value < kSubBuckets) {
+      return static_cast<std::size_t>(value);
+    }
+    std::size_t msb = 63 - __builtin_clzll(value);
+    std::size_t shift = msb - kSubBucketBits;
+    return (shift + 1) * kSubBuckets +
+           static_cast<std::size_t>((value >> shift) - kSubBuckets);
+  }
+
+  // the smallest and largest value recorded into bucket |index|
+  static std::uint64_t LowerBoundOf(std::size_t index);
+  static std::uint64_t UpperBoundOf(std::size_t index);
+
+  void Record(std::uint64_t value, std::uint64_t count = 1) {
+    Add(IndexOf(value), count);
+    sum_ += value * count;
+  }
+
+  // for merging buckets recorded somewhere else, |sum| is kept apart
+  void Add(std::size_t index, std::uint64_t count) {
+    buckets_[index] += count;
+    count_ += count;
+  }
+  void AddSum(std::uint64_t sum) { sum_ += sum; }
+
+  void Merge(const Histogram& other);
+  void Clear() { *this = Histogram{}; }
+
+  std::uint64_t count() const { return count_; }
+  std::uint64_t sum() const { return sum_; }
+  std::uint64_t bucket(std::size_t index) const { return buckets_[index]; }
+
+  double Mean() const;
+  std::uint64_t Min() const;
+  std::uint64_t Max() const;
+
+  // the upper bound of the bucket holding the |percentile|(0-100) value,
+  // zero if empty
+  std::uint64_t ValueAtPercentile(double percentile) const;
+
+ private:
+  std::array<std::uint64_t, kBuckets> buckets_{};
+  std::uint64_t count_{0};
+  std::uint64_t sum_{0};
+};
+
+}  // namespace base
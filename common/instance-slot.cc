@@ -0,0 +1,56 @@
+#include "instance-slot.h"
+
+#include <mutex>
+#include <vector>
+
+#include "no-destructor.h"
+
+namespace base {
+namespace {
+
+struct SlotTable {
+  std::mutex mutex;
+  // the id of the instance owning each index, zero if free
+  std::vector<std::uint64_t> ids;
+  std::vector<std::uint32_t> free;
+  std::uint64_t next_id{1};
+};
+
+SlotTable* GetTable() {
+  static NoDestructor<SlotTable> table;
+  return table.get();
+}
+
+}  // namespace
+
+InstanceSlot::InstanceSlot() {
+  auto table = GetTable();
+
+  std::lock_guard<std::mutex> lock(table->mutex);
+  if (table->free.empty()) {
+    index_ = static_cast<std::uint32_t>(table->ids.size());
+    table->ids.push_back(0);
+  } else {
+    index_ = table->free.back();
+    table->free.pop_back();
+  }
+  id_ = table->next_id++;
+  table->ids[index_] = id_;
+}
+
+InstanceSlot::~InstanceSlot() {
+  auto table = GetTable();
+
+  std::lock_guard<std::mutex> lock(table->mutex);
+  table->ids[index_] = 0;
+  table->free.push_back(index_);
+}
+
+bool InstanceSlot::IsAlive(std::uint32_t index, std::uint64_t id) {
+  auto table = GetTable();
+
+  std::lock_guard<std::mutex> lock(table->mutex);
+  return index < table->ids.size() && table->ids[index] == id;
+}
+
+}  // namespace base
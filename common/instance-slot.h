@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+#include "macros.h"
+
+namespace base {
+
+// |InstanceSlot| gives a live instance a small index, which is reused once
+// the instance is destroyed, and an id which is never reused. the thread
+// local caches indexed by the slot stay as small as the number of instances
+// alive at once, and tell the entries of the destroyed ones by their id.
+class InstanceSlot {
+ public:
+  InstanceSlot();
+  ~InstanceSlot();
+
+  std::uint32_t index() const { return index_; }
+  std::uint64_t id() const { return id_; }
+
+  // whether the instance |id| is still alive, it takes a lock, so it's meant
+  // for pruning the caches on a miss
+  static bool IsAlive(std::uint32_t index, std::uint64_t id);
+
+ private:
+  std::uint32_t index_;
+  std::uint64_t id_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(InstanceSlot);
+};
+
+}  // namespace base
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "macros.h"
+#include "no-destructor.h"
+
+namespace base {
+namespace _ {
+
+// |BlockPool| caches the freed blocks of |Size| bytes. each thread keeps the
+// blocks it frees in its own list, and moves them to the global depot by
+// batches once it holds two, so that the blocks freed by a consumer
+// thread flow back to the producing ones. a thread takes a batch from the
+// depot once its list is empty, then falls back to operator new.
+//
+// the blocks are returned to the system only when the depot is full. under
+// AddressSanitizer, the pool is bypassed to keep the use-after-free checks.
+template <std::size_t Size, std::size_t Align>
+class BlockPool {
+ public:
+  static constexpr std::size_t kBatchSize = 32;
+  static constexpr std::size_t kMaxDepotBatches = 64;
+
+  static void* Allocate() {
+#if !defined(__SANITIZE_ADDRESS__)
+    if (!HasExited()) {
+      auto& cache = GetLocalCache();
+      if (!cache.head) {
+        cache.Refill();
+      }
+      if (auto block = cache.head) {
+        cache.head = block->next;
+        --cache.count;
+        return block;
+      }
+    }
+#endif
+    return ::operator new(Size, std::align_val_t{Align});
+  }
+
+  static void Deallocate(void* p) {
+#if !defined(__SANITIZE_ADDRESS__)
+    if (!HasExited()) {
+      auto& cache = GetLocalCache();
+      auto block = static_cast<Block*>(p);
+      block->next = cache.head;
+      cache.head = block;
+      if (++cache.count >= 2 * kBatchSize) {
+        cache.Flush(kBatchSize);
+      }
+      return;
+    }
+#endif
+    ::operator delete(p, std::align_val_t{Align});
+  }
+
+ private:
+  struct Block {
+    Block* next;
+  };
+
+  struct Depot {
+    std::mutex mutex;
+    // each a list of |kBatchSize| blocks
+    std::vector<Block*> batches;
+  };
+
+  static Depot* GetDepot() {
+    static NoDestructor<Depot> depot;
+    return depot.get();
+  }
+
+  static void Free(Block* batch) {
+    while (batch) {
+      auto next = batch->next;
+      ::operator delete(batch, std::align_val_t{Align});
+      batch = next;
+    }
+  }
+
+  struct LocalCache {
+    Block* head{nullptr};
+    std::size_t count{0};
+
+    ~LocalCache() {
+      while (count >= kBatchSize) {
+        Flush(kBatchSize);
+      }
+      Free(head);
+      HasExited() = true;
+    }
+
+    void Refill() {
+      auto depot = GetDepot();
+      std::lock_guard<std::mutex> lock(depot->mutex);
+      if (!depot->batches.empty()) {
+        head = depot->batches.back();
+        count = kBatchSize;
+        depot->batches.pop_back();
+      }
+    }
+
+    // move the first |n| blocks to the depot
+    void Flush(std::size_t n) {
+      auto batch = head;
+      auto last = head;
+      for (std::size_t i = 1; i < n; ++i) {
+        last = last->next;
+      }
+      head = last->next;
+      count -= n;
+      last->next = nullptr;
+
+      auto depot = GetDepot();
+      {
+        std::lock_guard<std::mutex> lock(depot->mutex);
+        if (depot->batches.size() < kMaxDepotBatches) {
+          depot->batches.push_back(batch);
+          return;
+        }
+      }
+      Free(batch);
+    }
+  };
+
+  static LocalCache& GetLocalCache() {
+    thread_local LocalCache cache;
+    return cache;
+  }
+
+  // set once the cache of the thread is destroyed, the blocks freed later,
+  // e.g. by other thread local destructors, go back to the system
+  static bool& HasExited() {
+    thread_local bool exited = false;
+    return exited;
+  }
+};
+
+template <typename T>
+using BlockPoolOf =
+    BlockPool<(sizeof(T) + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*),
+              (alignof(T) > alignof(void*) ? alignof(T) : alignof(void*))>;
+
+}  // namespace _
+
+// |ObjectPool| allocates the objects of |T| from the blocks cached per thread,
+// the types of the same size share a pool. the objects may be deleted by any
+// thread.
+//
+// eg.
+// auto node = ObjectPool<Node>::New(value);
+// ObjectPool<Node>::Delete(node);
+template <typename T>
+class ObjectPool {
+ public:
+  struct Deleter {
+    void operator()(T* object) const { Delete(object); }
+  };
+  using UniquePtr = std::unique_ptr<T, Deleter>;
+
+  template <typename... ARGS>
+  static T* New(ARGS&&... args) {
+    return ::new (Pool::Allocate()) T(std::forward<ARGS>(args)...);
+  }
+
+  template <typename... ARGS>
+  static UniquePtr MakeUnique(ARGS&&... args) {
+    return UniquePtr{New(std::forward<ARGS>(args)...)};
+  }
+
+  static void Delete(T* object) {
+    if (object) {
+      object->~T();
+      Pool::Deallocate(object);
+    }
+  }
+
+ private:
+  using Pool = _::BlockPoolOf<T>;
+
+  ObjectPool() = delete;
+};
+
+// |PoolAllocator| is the allocator adapter of |ObjectPool|, the single
+// objects are taken from the pool, the arrays from operator new. it's meant
+// for |std::allocate_shared|, and node based containers.
+template <typename T>
+class PoolAllocator {
+ public:
+  using value_type = T;
+
+  PoolAllocator() = default;
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>&) {}
+
+  T* allocate(std::size_t n) {
+    if (n == 1) {
+      return static_cast<T*>(_::BlockPoolOf<T>::Allocate());
+    }
+    return static_cast<T*>(
+        ::operator new(n * sizeof(T), std::align_val_t{alignof(T)}));
+  }
+
+  void deallocate(T* p, std::size_t n) {
+    if (n == 1) {
+      _::BlockPoolOf<T>::Deallocate(p);
+    } else {
+      ::operator delete(p, std::align_val_t{alignof(T)});
+    }
+  }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const PoolAllocator<U>&) const {
+    return false;
+  }
+};
+
+}  // namespace base
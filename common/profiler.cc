@@ -0,0 +1,278 @@
+#include "profiler.h"
+
+#include <fmt/format.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+
+#include "check.h"
+#include "common.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace base {
+
+struct Profiler::ThreadProfile {
+  struct Sample {
+    int depth;
+    void* frames[kMaxDepth];
+  };
+
+  pid_t tid;
+  pthread_t thread;
+  timer_t timer;
+  bool armed{false};
+
+  // the single producer is the signal handler in the owning thread, and the
+  // single consumer the collection, with the profiler lock held
+  Sample samples[kRingSize];
+  std::atomic<std::uint64_t> head{0};
+  std::atomic<std::uint64_t> tail{0};
+  std::atomic<std::uint64_t> dropped{0};
+};
+
+thread_local Profiler::ThreadProfile* Profiler::tls_profile_ = nullptr;
+
+Profiler* Profiler::Get() {
+  static auto profiler = new Profiler;
+  return profiler;
+}
+
+Profiler::Profiler() {}
+
+void Profiler::OnSignal(int, siginfo_t*, void* context) {
+  auto saved_errno = errno;
+
+  auto profile = tls_profile_;
+  if (profile) {
+    auto head = profile->head.load(std::memory_order_relaxed);
+    if (head - profile->tail.load(std::memory_order_acquire) >= kRingSize) {
+      profile->dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      auto& sample = profile->samples[head % kRingSize];
+      sample.depth = GetSignalStackTrace(context, sample.frames, kMaxDepth);
+      profile->head.store(head + 1, std::memory_order_release);
+    }
+  }
+
+  errno = saved_errno;
+}
+
+void Profiler::RegisterThread() {
+  if (tls_profile_) {
+    return;
+  }
+
+  // unregistered once the thread exits
+  thread_local struct Unregister {
+    ~Unregister() { Profiler::Get()->UnregisterThread(); }
+  } unregister;
+
+  auto profile = new ThreadProfile;
+  profile->tid = static_cast<pid_t>(syscall(SYS_gettid));
+  profile->thread = pthread_self();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  tls_profile_ = profile;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+
+  threads_.push_back(profile);
+  if (IsRunning()) {
+    Arm(profile);
+  }
+}
+
+void Profiler::UnregisterThread() {
+  auto profile = tls_profile_;
+  if (!profile) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  Disarm(profile);
+  // a signal already pending finds no profile
+  tls_profile_ = nullptr;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+
+  Drain(profile);
+  threads_.erase(std::find(threads_.begin(), threads_.end(), profile));
+  delete profile;
+}
+
+bool Profiler::Start(int frequency) {
+  DCHECK(frequency > 0);
+
+  static std::once_flag once;
+  std::call_once(once, []() {
+    struct sigaction action = {};
+    action.sa_sigaction = OnSignal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    CHECK(sigaction(kSignal, &action, nullptr) == 0);
+  });
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (IsRunning()) {
+    return false;
+  }
+
+  frequency_ = frequency;
+  for (auto profile : threads_) {
+    if (!Arm(profile)) {
+      for (auto p : threads_) {
+        Disarm(p);
+      }
+      return false;
+    }
+  }
+
+  running_.store(true, std::memory_order_relaxed);
+  collector_ = std::thread([this]() { RunCollector(); });
+  return true;
+}
+
+void Profiler::Stop() {
+  std::thread collector;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!IsRunning()) {
+      return;
+    }
+    running_.store(false, std::memory_order_relaxed);
+
+    for (auto profile : threads_) {
+      Disarm(profile);
+    }
+    Collect();
+
+    collector = std::move(collector_);
+    cond_.notify_all();
+  }
+  collector.join();
+}
+
+bool Profiler::Arm(ThreadProfile* profile) {
+  if (!profile->armed) {
+    clockid_t clock;
+    if (pthread_getcpuclockid(profile->thread, &clock) != 0) {
+      return false;
+    }
+
+    struct sigevent event = {};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = kSignal;
+    event.sigev_notify_thread_id = profile->tid;
+    if (timer_create(clock, &event, &profile->timer) != 0) {
+      return false;
+    }
+    profile->armed = true;
+  }
+
+  auto interval = 1000000000L / frequency_;
+  struct itimerspec spec = {};
+  spec.it_interval.tv_sec = interval / 1000000000L;
+  spec.it_interval.tv_nsec = interval % 1000000000L;
+  spec.it_value = spec.it_interval;
+  return timer_settime(profile->timer, 0, &spec, nullptr) == 0;
+}
+
+void Profiler::Disarm(ThreadProfile* profile) {
+  if (profile->armed) {
+    timer_delete(profile->timer);
+    profile->armed = false;
+  }
+}
+
+void Profiler::Collect() {
+  for (auto profile : threads_) {
+    Drain(profile);
+  }
+}
+
+void Profiler::Drain(ThreadProfile* profile) {
+  auto tail = profile->tail.load(std::memory_order_relaxed);
+  auto head = profile->head.load(std::memory_order_acquire);
+  for (; tail != head; ++tail) {
+    auto& sample = profile->samples[tail % kRingSize];
+    if (sample.depth > 0) {
+      ++stacks_[std::vector<void*>(sample.frames,
+                                   sample.frames + sample.depth)];
+    }
+    ++samples_;
+  }
+  profile->tail.store(tail, std::memory_order_release);
+
+  dropped_ += profile->dropped.exchange(0, std::memory_order_relaxed);
+}
+
+void Profiler::RunCollector() {
+  static constexpr auto kInterval = std::chrono::milliseconds(100);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (IsRunning()) {
+    cond_.wait_for(lock, kInterval);
+    Collect();
+  }
+}
+
+std::string Profiler::GetFoldedStacks() {
+  std::map<std::vector<void*>, std::uint64_t> stacks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Collect();
+    stacks = stacks_;
+  }
+
+  // different PCs in the same functions fold into a single line
+  std::map<std::string, std::uint64_t> folded;
+  for (auto& [frames, count] : stacks) {
+    std::string line;
+    for (auto i = frames.size(); i-- > 0;) {
+      // the callers are return addresses, which may be past the call
+      auto pc = static_cast<char*>(frames[i]) - (i == 0 ? 0 : 1);
+      char name[kMaxSymbolLength];
+      if (Symbolize(pc, name, sizeof(name))) {
+        line.append(name);
+      } else {
+        line.append(fmt::format("{}", frames[i]));
+      }
+      if (i != 0) {
+        line.push_back(';');
+      }
+    }
+    folded[line] += count;
+  }
+
+  std::string text;
+  for (auto& [line, count] : folded) {
+    text.append(fmt::format("{} {}\n", line, count));
+  }
+  return text;
+}
+
+std::uint64_t Profiler::samples() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return samples_;
+}
+
+std::uint64_t Profiler::dropped() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_;
+}
+
+void Profiler::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Collect();
+  stacks_.clear();
+  samples_ = 0;
+  dropped_ = 0;
+}
+
+}  // namespace base
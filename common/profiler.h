@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "macros.h"
+
+namespace base {
+
+// |Profiler| is an in-process sampling CPU profiler. every registered thread
+// gets a timer on its own CPU clock, which sends it |kSignal| |frequency|
+// times per second of CPU time it consumes. the handler captures the raw PCs
+// into the lock-free ring of the thread, a collector thread drains the rings
+// and aggregates the stacks, which are symbolized only when they are printed.
+//
+// a sample costs an unwind of a few microseconds, that's well under 1% of the
+// CPU time at 100Hz. the profiler owns |kSignal| of the process.
+class Profiler {
+ public:
+  static constexpr int kSignal = SIGPROF;
+  static constexpr int kMaxDepth = 32;
+  // samples buffered per thread between two collections
+  static constexpr std::size_t kRingSize = 256;
+
+  static Profiler* Get();
+
+  // sample the calling thread while the profiler is running, until it exits
+  // or unregisters. it can be called whether the profiler is running or not.
+  void RegisterThread();
+  void UnregisterThread();
+
+  // false if it's running already, or the timers can not be created. start
+  // and stop are called by a single controlling thread.
+  bool Start(int frequency = 100);
+  // the buffered samples are collected before returning
+  void Stop();
+  bool IsRunning() const { return running_.load(std::memory_order_relaxed); }
+
+  // one line per distinct stack, the frames from the root to the leaf joined
+  // by ';', followed by the number of samples, as flamegraph.pl takes
+  std::string GetFoldedStacks();
+
+  // collected samples, and the ones lost to full rings
+  std::uint64_t samples() const;
+  std::uint64_t dropped() const;
+
+  // forget the collected samples
+  void Reset();
+
+ private:
+  struct ThreadProfile;
+
+  Profiler();
+
+  static void OnSignal(int signo, siginfo_t* info, void* context);
+
+  bool Arm(ThreadProfile* profile);
+  void Disarm(ThreadProfile* profile);
+
+  // drain the rings of every registered thread, must be called with lock held
+  void Collect();
+  void Drain(ThreadProfile* profile);
+
+  void RunCollector();
+
+ private:
+  std::atomic<bool> running_{false};
+  int frequency_{0};
+
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::thread collector_;
+  std::vector<ThreadProfile*> threads_;
+
+  // the raw PCs of a stack, from the leaf, and its samples
+  std::map<std::vector<void*>, std::uint64_t> stacks_;
+  std::uint64_t samples_{0};
+  std::uint64_t dropped_{0};
+
+  // the profile of the calling thread, if it's registered
+  static thread_local ThreadProfile* tls_profile_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(Profiler);
+};
+
+}  // namespace base
@@ -1,24 +1,142 @@
 #pragma once
 
-#include <optional>
-#include <variant>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 #include "check.h"
 #include "error.h"
+#include "macros.h"
 
 namespace base {
 
 template <typename T>
-class Result {
+class Result;
+
+template <typename T>
+struct IsResult : std::false_type {};
+
+template <typename T>
+struct IsResult<Result<T>> : std::true_type {};
+
+namespace _ {
+
+enum class ResultState : std::uint8_t { kEmpty, kOk, kError };
+
+// |ResultStorage| is a union of the value and the error, tagged by a single
+// byte. the value is neither destructed nor visited when it's trivial, a
+// trivially copyable one is copied as raw bytes, whatever the state is.
+//
+// the storage itself can't be trivially copyable, the error it may hold
+// references a shared message.
+template <typename T>
+class ResultStorage {
  public:
-  using ValueTyupe = T;
+  ResultStorage() {}
+  ResultStorage(ResultStorage&& other) noexcept(
+      std::is_nothrow_move_constructible_v<T>) {
+    ConstructFrom(std::move(other));
+  }
+  ResultStorage(const ResultStorage& other) noexcept(
+      std::is_nothrow_copy_constructible_v<T>) {
+    ConstructFrom(other);
+  }
+  ResultStorage& operator=(ResultStorage&& other) noexcept(
+      std::is_nothrow_move_constructible_v<T>) {
+    if (this != &other) {
+      Destroy();
+      ConstructFrom(std::move(other));
+    }
+    return *this;
+  }
+  ResultStorage& operator=(const ResultStorage& other) noexcept(
+      std::is_nothrow_copy_constructible_v<T>) {
+    if (this != &other) {
+      Destroy();
+      ConstructFrom(other);
+    }
+    return *this;
+  }
+  ~ResultStorage() { Destroy(); }
+
+  template <typename... Args>
+  void EmplaceValue(Args&&... args) {
+    new (&value) T(std::forward<Args>(args)...);
+    state = ResultState::kOk;
+  }
+
+  template <typename E>
+  void EmplaceError(E&& e) {
+    new (&error) Error(std::forward<E>(e));
+    state = ResultState::kError;
+  }
+
+  void Destroy() {
+    if (state == ResultState::kOk) {
+      if constexpr (!std::is_trivially_destructible_v<T>) {
+        value.~T();
+      }
+    } else if (state == ResultState::kError) {
+      error.~Error();
+    }
+    state = ResultState::kEmpty;
+  }
+
+  union {
+    T value;
+    Error error;
+  };
+  ResultState state{ResultState::kEmpty};
 
-  Result() : v_() {}
-  Result(const T& ok) : v_(ok) {}
-  Result(T&& ok) : v_(std::move(ok)) {}
+ private:
+  template <typename S>
+  void ConstructFrom(S&& other) {
+    if constexpr (std::is_trivially_copyable_v<T>) {
+      if (other.state == ResultState::kError) {
+        EmplaceError(std::forward<S>(other).error);
+      } else {
+        std::memcpy(static_cast<void*>(&value), &other.value, sizeof(T));
+        state = other.state;
+      }
+    } else if (other.state == ResultState::kOk) {
+      EmplaceValue(std::forward<S>(other).value);
+    } else if (other.state == ResultState::kError) {
+      EmplaceError(std::forward<S>(other).error);
+    }
+  }
+};
 
-  Result(const Error& err) : v_(err) {}
-  Result(Error&& err) : v_(std::move(err)) {}
+// deletes the copies of |Result| holding a move-only value
+template <bool Copyable>
+struct ResultCopy {};
+
+template <>
+struct ResultCopy<false> {
+  ResultCopy() = default;
+  ResultCopy(ResultCopy&&) = default;
+  ResultCopy(const ResultCopy&) = delete;
+  ResultCopy& operator=(ResultCopy&&) = default;
+  ResultCopy& operator=(const ResultCopy&) = delete;
+};
+
+}  // namespace _
+
+// |Result| is either empty, a value, or an error. it's as large as the larger
+// of |T| and |Error|, plus one byte of state.
+template <typename T>
+class Result : private _::ResultCopy<std::is_copy_constructible_v<T>> {
+ public:
+  using ValueType = T;
+
+  Result() = default;
+  Result(const T& ok) { s_.EmplaceValue(ok); }
+  Result(T&& ok) { s_.EmplaceValue(std::move(ok)); }
+
+  Result(const Error& err) { s_.EmplaceError(err); }
+  Result(Error&& err) { s_.EmplaceError(std::move(err)); }
 
   Result(Result&&) = default;
   Result(const Result&) = default;
@@ -27,24 +145,43 @@ class Result {
   Result& operator=(const Result&) = default;
 
  public:
-  bool IsEmpty() const { return v_.index() == kEmpty; }
-  bool IsOk() const { return v_.index() == kOk; }
-  bool IsError() const { return v_.index == kError; }
+  bool IsEmpty() const { return s_.state == _::ResultState::kEmpty; }
+  bool IsOk() const { return s_.state == _::ResultState::kOk; }
+  bool IsError() const { return s_.state == _::ResultState::kError; }
   operator bool() const { return IsOk(); }
 
-  void Clear() { v_ = Null{}; }
+  void Clear() { s_.Destroy(); }
 
  public:
+  // the value or error is moved out, and the result is left holding the
+  // moved-from one instead of being cleared
   T PassResult();
   const T& GetResult() const;
 
   Error PassError();
   const Error& GetError() const;
 
+ public:
+  // the combinators consume a settled result, the value or error is moved
+  // into |f| once, and the error is passed on as is.
+
+  // |f| maps the value to another one, or to void
+  template <typename F, typename U = std::invoke_result_t<F, T&&>>
+  Result<U> Map(F&& f) &&;
+
+  // |f| takes the value, and returns another |Result|
+  template <typename F, typename R = std::invoke_result_t<F, T&&>>
+  R AndThen(F&& f) &&;
+
+  // |f| takes the error, and returns a |Result<T>| recovered from it
+  template <typename F>
+  Result OrElse(F&& f) &&;
+
+  template <typename U>
+  T ValueOr(U&& fallback) &&;
+
  private:
-  struct Null {};
-  enum { kEmpty, kOk, kError };
-  std::variant<Null, T, Error> v_;
+  _::ResultStorage<T> s_;
 };
 
 template <>
@@ -74,52 +211,143 @@ class Result<void> {
   Error PassError() { return std::move(v_); }
   const Error& GetError() const { return v_; }
 
+ public:
+  template <typename F, typename U = std::invoke_result_t<F>>
+  Result<U> Map(F&& f) && {
+    if (UNLIKELY(!IsOk())) {
+      return PassError();
+    }
+    if constexpr (std::is_void_v<U>) {
+      std::invoke(std::forward<F>(f));
+      return {};
+    } else {
+      return std::invoke(std::forward<F>(f));
+    }
+  }
+
+  template <typename F, typename R = std::invoke_result_t<F>>
+  R AndThen(F&& f) && {
+    static_assert(IsResult<R>::value, "f should return a result");
+    if (UNLIKELY(!IsOk())) {
+      return PassError();
+    }
+    return std::invoke(std::forward<F>(f));
+  }
+
+  template <typename F>
+  Result OrElse(F&& f) && {
+    if (IsOk()) {
+      return {};
+    }
+    return std::invoke(std::forward<F>(f), PassError());
+  }
+
  private:
   Error v_;
 };
 
 template <typename T>
-struct IsResult : std::false_type {};
+T Result<T>::PassResult() {
+  DCHECK(IsOk());
+  return std::move(s_.value);
+}
 
 template <typename T>
-struct IsResult<Result<T>> : std::true_type {};
+const T& Result<T>::GetResult() const {
+  DCHECK(IsOk());
+  return s_.value;
+}
 
 template <typename T>
-T Result<T>::PassResult() {
-  auto ptr = std::get_if<T>(&v_);
+Error Result<T>::PassError() {
+  DCHECK(IsError());
+  return std::move(s_.error);
+}
 
-  DCHECK(ptr);
-  auto result = std::move(*ptr);
+template <typename T>
+const Error& Result<T>::GetError() const {
+  DCHECK(IsError());
+  return s_.error;
+}
 
-  Clear();
-  return result;
+template <typename T>
+template <typename F, typename U>
+Result<U> Result<T>::Map(F&& f) && {
+  if (UNLIKELY(!IsOk())) {
+    return PassError();
+  }
+  if constexpr (std::is_void_v<U>) {
+    std::invoke(std::forward<F>(f), std::move(s_.value));
+    return {};
+  } else {
+    return std::invoke(std::forward<F>(f), std::move(s_.value));
+  }
 }
 
 template <typename T>
-const T& Result<T>::GetResult() const {
-  auto ptr = std::get_if<T>(&v_);
+template <typename F, typename R>
+R Result<T>::AndThen(F&& f) && {
+  static_assert(IsResult<R>::value, "f should return a result");
+  if (UNLIKELY(!IsOk())) {
+    return PassError();
+  }
+  return std::invoke(std::forward<F>(f), std::move(s_.value));
+}
 
-  DCHECK(ptr);
-  return *ptr;
+template <typename T>
+template <typename F>
+Result<T> Result<T>::OrElse(F&& f) && {
+  if (IsOk()) {
+    return std::move(*this);
+  }
+  return std::invoke(std::forward<F>(f), PassError());
 }
 
 template <typename T>
-Error Result<T>::PassError() {
-  auto ptr = std::get_if<Error>(&v_);
+template <typename U>
+T Result<T>::ValueOr(U&& fallback) && {
+  if (IsOk()) {
+    return std::move(s_.value);
+  }
+  return static_cast<T>(std::forward<U>(fallback));
+}
 
-  DCHECK(ptr);
-  auto error = std::move(*ptr);
+}  // namespace base
 
-  Clear();
-  return error;
-}
+// evaluate |expr| to a |Result|, return its error from the enclosing function
+// if it failed, otherwise yield the value moved out of it, or nothing for
+// |Result<void>|. the enclosing function returns a |Result| or an |Error|.
+// |expr| is bound by reference, so the value is moved exactly once.
+#define TRY(expr)                                      \
+  ({                                                   \
+    auto&& base_try_result_ = (expr);                  \
+    if (UNLIKELY(!base_try_result_)) {                 \
+      return ::base::_::TryError(&base_try_result_);   \
+    }                                                  \
+    ::base::_::TryValue(std::move(base_try_result_));  \
+  })
 
+namespace base {
+namespace _ {
+
+// moved out only once the state is checked. an empty result has no error to
+// pass on, and an empty error would read as a success, so it's a programming
+// error.
 template <typename T>
-const Error& Result<T>::GetError() const {
-  auto ptr = std::get_if<Error>(&v_);
+Error TryError(Result<T>* r) {
+  CHECK(r->IsError());
+  return r->PassError();
+}
+
+inline Error TryError(Result<void>* r) { return r->PassError(); }
 
-  DCHECK(ptr);
-  return *ptr;
+template <typename T>
+T TryValue(Result<T>&& r) {
+  return std::move(r).PassResult();
 }
 
+inline void TryValue(Result<void>&&) {}
+
+}  // namespace _
+
 }  // namespace base
@@ -21,6 +21,12 @@ void TimerWheelSlot::Cancel(Error&& err) {
 
 }  // namespace _
 
+TimerWheel::TimerWheel(Tick now) : ticks_pending_(0) {
+  for (int i = 0; i < kNumLevels; ++i) {
+    now_[i] = now >> (kWidthBits * i);
+  }
+}
+
 void TimerWheel::Abort() {
   for (std::size_t i = 0; i < kNumLevels; ++i) {
     for (std::size_t j = 0; j < kNumSlots; ++j) {
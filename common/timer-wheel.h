@@ -40,6 +40,7 @@
 // rotation of the second wheel, one slot's worth of events is
 // promoted from the third wheel to the second, and so on.
 
+#include <limits>
 #include <memory>
 
 #include "error.h"
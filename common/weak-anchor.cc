@@ -0,0 +1,69 @@
+#include "weak-anchor.h"
+
+#include <mutex>
+#include <vector>
+
+#include "check.h"
+#include "no-destructor.h"
+
+namespace base {
+namespace _ {
+
+std::atomic<WeakSlot*> g_weak_slot_chunks[kMaxWeakSlotChunks];
+
+namespace {
+
+struct WeakSlotAllocator {
+  std::mutex mutex;
+  std::vector<std::uint32_t> free;
+  std::uint32_t next{0};
+
+  std::uint32_t Allocate() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!free.empty()) {
+      auto index = free.back();
+      free.pop_back();
+      return index;
+    }
+
+    auto index = next++;
+    auto chunk = index >> kWeakSlotChunkBits;
+    CHECK(chunk < kMaxWeakSlotChunks);
+    if ((index & (kWeakSlotChunkSize - 1)) == 0) {
+      g_weak_slot_chunks[chunk].store(new WeakSlot[kWeakSlotChunkSize],
+                                      std::memory_order_release);
+    }
+    return index;
+  }
+
+  void Free(std::uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    free.push_back(index);
+  }
+};
+
+WeakSlotAllocator* GetAllocator() {
+  static NoDestructor<WeakSlotAllocator> allocator;
+  return allocator.get();
+}
+
+WeakSlot& GetMutableWeakSlot(std::uint32_t index) {
+  return const_cast<WeakSlot&>(GetWeakSlot(index));
+}
+
+}  // namespace
+}  // namespace _
+
+WeakAnchor::WeakAnchor() : index_(_::GetAllocator()->Allocate()) {}
+
+WeakAnchor::~WeakAnchor() {
+  Invalidate();
+  _::GetAllocator()->Free(index_);
+}
+
+void WeakAnchor::Invalidate() {
+  _::GetMutableWeakSlot(index_).generation.fetch_add(
+      1, std::memory_order_release);
+}
+
+}  // namespace base
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include "macros.h"
+
+namespace base {
+namespace _ {
+
+struct WeakSlot {
+  std::atomic<std::uint32_t> generation{0};
+};
+
+constexpr std::size_t kWeakSlotChunkBits = 10;
+constexpr std::size_t kWeakSlotChunkSize = std::size_t{1} << kWeakSlotChunkBits;
+constexpr std::size_t kMaxWeakSlotChunks = 4096;
+
+// the slots are allocated by chunks, which are never freed, and published
+// before any handle refers to them
+extern std::atomic<WeakSlot*> g_weak_slot_chunks[kMaxWeakSlotChunks];
+
+inline const WeakSlot& GetWeakSlot(std::uint32_t index) {
+  auto chunk = g_weak_slot_chunks[index >> kWeakSlotChunkBits].load(
+      std::memory_order_acquire);
+  return chunk[index & (kWeakSlotChunkSize - 1)];
+}
+
+}  // namespace _
+
+// |WeakHandle| refers to an object owning a |WeakAnchor|, and turns invalid
+// once the anchor is destroyed or invalidated. it's a slot index and the
+// generation of that slot, the slots are reused but never freed, so the
+// handle is copied like an integer, and checked by a single load.
+//
+// unlike |std::weak_ptr|, it does not keep the object alive while used. it's
+// meant for objects with a single owner, checked in the sequence destroying
+// the object, e.g. the callbacks posted to the strand owning it.
+class WeakHandle {
+ public:
+  WeakHandle() = default;
+
+  bool IsValid() const {
+    return index_ != kInvalidIndex &&
+           _::GetWeakSlot(index_).generation.load(std::memory_order_acquire) ==
+               generation_;
+  }
+  explicit operator bool() const { return IsValid(); }
+
+ private:
+  static constexpr std::uint32_t kInvalidIndex =
+      std::numeric_limits<std::uint32_t>::max();
+
+  WeakHandle(std::uint32_t index, std::uint32_t generation)
+      : index_(index), generation_(generation) {}
+
+  std::uint32_t index_{kInvalidIndex};
+  std::uint32_t generation_{0};
+
+  friend class WeakAnchor;
+};
+
+// |WeakAnchor| is a member of the object |WeakHandle|s refer to, the last
+// one, so that the handles are invalidated before the other members are
+// destroyed.
+class WeakAnchor {
+ public:
+  WeakAnchor();
+  ~WeakAnchor();
+
+  WeakHandle GetHandle() const {
+    return WeakHandle{
+        index_,
+        _::GetWeakSlot(index_).generation.load(std::memory_order_relaxed)};
+  }
+
+  // invalidate the handles handed out so far
+  void Invalidate();
+
+ private:
+  std::uint32_t index_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(WeakAnchor);
+};
+
+}  // namespace base
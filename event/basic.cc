@@ -22,11 +22,21 @@ struct EventCategory : public Error::Category {
   }
 };
 
+EventCategory* RegisterEventCategory() {
+  static EventCategory kC;
+  ErrorRegistry::Register(&kC, {
+#define __(A, B) A,
+      EVENT_ERROR_LIST(__)
+#undef __
+  });
+  return &kC;
+}
+
 }  // namespace
 
 const Error::Category* Cat() {
-  static EventCategory kC;
-  return &kC;
+  static EventCategory* kC = RegisterEventCategory();
+  return kC;
 }
 
 }  // namespace event
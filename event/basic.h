@@ -3,8 +3,14 @@
 #include <common/error.h>
 #include <fmt/format.h>
 
-#define EVENT_ERROR_LIST(__) \
-  __(kErrorEventPromiseAny, "promise any operation failed")
+#include <string>
+#include <utility>
+
+#define EVENT_ERROR_LIST(__)                                  \
+  __(kErrorEventPromiseAny, "promise any operation failed")   \
+  __(kErrorEventChannelClosed, "channel has been closed")     \
+  __(kErrorEventExecutorOverloaded, "executor is overloaded") \
+  __(kErrorEventTimerAborted, "timer wheel has been aborted")
 
 namespace base {
 namespace event {
@@ -19,11 +25,22 @@ const Error::Category *Cat();
 
 inline Error Err(EventError e) { return Error{Cat(), e}; }
 
-template <typename... T>
-Error Err(EventError e, const T &... args) {
-  auto msg = fmt::format(args...);
+inline Error Err(EventError e, std::string msg) {
   return Error{Cat(), e, std::move(msg)};
 }
 
+// the message is referenced instead of copied, it must outlive the error
+inline Error Err(EventError e, Error::StaticMessage msg) {
+  return Error{Cat(), e, msg};
+}
+
+// the arguments are captured, and the message is formatted only when it's
+// read. |format| is referenced, it must be a literal.
+template <typename A, typename... T>
+Error Err(EventError e, const char *format, A &&arg, T &&... args) {
+  return Error::Lazy(Cat(), e, format, std::forward<A>(arg),
+                     std::forward<T>(args)...);
+}
+
 }  // namespace event
 }  // namespace base
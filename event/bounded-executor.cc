@@ -0,0 +1,113 @@
+#include "bounded-executor.h"
+
+#include <common/common.h>
+
+#include <utility>
+
+namespace base {
+namespace event {
+
+// |Ticket| is the place of a queued callback, released once the callback
+// starts to run, or once the executor destroys it unrun
+class BoundedExecutor::Ticket {
+ public:
+  explicit Ticket(BoundedExecutor* owner) : owner_(owner) {}
+
+  Ticket(Ticket&& other) noexcept
+      : owner_(std::exchange(other.owner_, nullptr)) {}
+  // |std::function| has to be copyable, but the executors move the
+  // callbacks. a copy holds no place, so copying a ticket holding one would
+  // lose it on either side.
+  Ticket(const Ticket& other) : owner_(nullptr) { DCHECK(!other.owner_); }
+
+  ~Ticket() { Release(); }
+
+  void Release() {
+    if (auto owner = std::exchange(owner_, nullptr)) {
+      owner->OnDequeued(
+          owner->size_.fetch_sub(1, std::memory_order_relaxed) - 1);
+    }
+  }
+
+ private:
+  BoundedExecutor* owner_;
+};
+
+BoundedExecutor::BoundedExecutor(Executor* executor, std::size_t capacity)
+    : executor_(executor),
+      capacity_(capacity),
+      high_watermark_(capacity),
+      low_watermark_(capacity) {
+  DCHECK(executor_);
+  DCHECK(capacity_ > 0);
+}
+
+void BoundedExecutor::SetWatermarks(std::size_t high, std::size_t low,
+                                    WatermarkCallback callback) {
+  DCHECK(low <= high);
+  DCHECK(size() == 0);
+  high_watermark_ = high;
+  low_watermark_ = low;
+  watermark_callback_ = std::move(callback);
+}
+
+void BoundedExecutor::Post(std::function<void()>&& f) {
+  OnQueued(size_.fetch_add(1, std::memory_order_relaxed) + 1);
+  Enqueue(std::move(f));
+}
+
+PostStatus BoundedExecutor::TryPost(std::function<void()>&& f) {
+  auto size = size_.load(std::memory_order_relaxed);
+  do {
+    if (size >= capacity_) {
+      return PostStatus::kOverloaded;
+    }
+  } while (!size_.compare_exchange_weak(size, size + 1,
+                                        std::memory_order_relaxed));
+
+  OnQueued(size + 1);
+  Enqueue(std::move(f));
+  return PostStatus::kAccepted;
+}
+
+void BoundedExecutor::Enqueue(std::function<void()>&& f) {
+  executor_->Post([ticket = Ticket(this), f = std::move(f)]() mutable {
+    ticket.Release();
+    f();
+  });
+}
+
+// the crossings are serialized, and decided by the size read under the lock,
+// so the callback sees them in order, and a stale crossing is dropped
+void BoundedExecutor::OnQueued(std::size_t size) {
+  if (size < high_watermark_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(watermark_mutex_);
+  if (overloaded_.load(std::memory_order_relaxed) ||
+      this->size() < high_watermark_) {
+    return;
+  }
+  overloaded_.store(true, std::memory_order_relaxed);
+  if (watermark_callback_) {
+    watermark_callback_(true);
+  }
+}
+
+void BoundedExecutor::OnDequeued(std::size_t size) {
+  if (size > low_watermark_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(watermark_mutex_);
+  if (!overloaded_.load(std::memory_order_relaxed) ||
+      this->size() > low_watermark_) {
+    return;
+  }
+  overloaded_.store(false, std::memory_order_relaxed);
+  if (watermark_callback_) {
+    watermark_callback_(false);
+  }
+}
+
+}  // namespace event
+}  // namespace base
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <common/macros.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+#include "basic.h"
+#include "executor.h"
+#include "promise.h"
+
+namespace base {
+namespace event {
+
+enum class PostStatus : std::uint8_t {
+  kAccepted,
+  // the queue is at its capacity, the callback is not posted
+  kOverloaded,
+};
+
+// |BoundedExecutor| limits the number of callbacks queued on another
+// executor, so the overload is shed at the edge, instead of growing the
+// queue. a callback counts from its post until it starts to run.
+//
+// |TryPost| and |PostOrReject| refuse callbacks beyond |capacity|, while
+// |Post| always accepts since it can not fail, but it's counted as well. a
+// callback dropped unrun by the executor stops counting once it's destroyed.
+//
+// the executor must outlive the callbacks it has posted.
+class BoundedExecutor : public Executor {
+ public:
+  // called with true once the queue reaches the high watermark, then with
+  // false once it drains to the low watermark. it's called in the thread
+  // crossing the watermark, one crossing at a time, and must not post to
+  // this executor.
+  using WatermarkCallback = std::function<void(bool overloaded)>;
+
+  BoundedExecutor(Executor* executor, std::size_t capacity);
+
+  // must be set before anything is posted
+  void SetWatermarks(std::size_t high, std::size_t low,
+                     WatermarkCallback callback);
+
+  void Post(std::function<void()>&& f) override;
+
+  PostStatus TryPost(std::function<void()>&& f);
+
+  // run |f| returning a |Result|, the returned promise is settled with its
+  // result in |executor|, or rejected by |kErrorEventExecutorOverloaded| right
+  // away if the queue is full. |executor| is the one of the caller, the
+  // promise is not settled by a worker in place, while the caller may be
+  // attaching its callback.
+  template <typename F, typename RT = std::invoke_result_t<F>,
+            typename T = typename RT::ValueType>
+  Promise<T> PostOrReject(F&& f, Executor* executor);
+
+  std::size_t size() const { return size_.load(std::memory_order_relaxed); }
+  std::size_t capacity() const { return capacity_; }
+
+  bool IsOverloaded() const {
+    return overloaded_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  class Ticket;
+
+  void Enqueue(std::function<void()>&& f);
+
+  void OnQueued(std::size_t size);
+  void OnDequeued(std::size_t size);
+
+ private:
+  Executor* executor_;
+  std::size_t capacity_;
+
+  std::size_t high_watermark_;
+  std::size_t low_watermark_;
+  WatermarkCallback watermark_callback_;
+
+  std::atomic<std::size_t> size_{0};
+  std::atomic<bool> overloaded_{false};
+  // serializes the watermark crossings
+  std::mutex watermark_mutex_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(BoundedExecutor);
+};
+
+template <typename F, typename RT, typename T>
+Promise<T> BoundedExecutor::PostOrReject(F&& f, Executor* executor) {
+  DCHECK(executor);
+
+  Promise<T> done;
+  auto status = TryPost([done, f = std::forward<F>(f), executor]() mutable {
+    // settled by a hop to |executor|, the result is shared since
+    // |std::function| has to be copyable
+    auto result = std::make_shared<RT>(f());
+    executor->Post([done, result]() mutable {
+      if (!*result) {
+        done.Reject(result->PassError());
+        return;
+      }
+      auto resolver = [&done](auto&&... v) {
+        return done.Resolve(std::forward<decltype(v)>(v)...);
+      };
+      _::ResolveWith(resolver, std::move(*result));
+    });
+  });
+
+  if (status != PostStatus::kAccepted) {
+    return MkRejectedPromise<T>(Err(kErrorEventExecutorOverloaded,
+                                    "{} callbacks queued", capacity_));
+  }
+  return done;
+}
+
+}  // namespace event
+}  // namespace base
@@ -0,0 +1,198 @@
+#define CATCH_CONFIG_MAIN
+#include "channel.h"
+
+#include <catch-include.h>
+
+#include <memory>
+#include <thread>
+
+#include "mock-executor.h"
+
+namespace base {
+namespace event {
+
+TEST_CASE("send and receive", "[channel]") {
+  MockExecutor exec;
+  Channel<int> ch(2);
+
+  REQUIRE(ch.capacity() == 2);
+
+  auto s0 = ch.Send(1, &exec);
+  auto s1 = ch.Send(2, &exec);
+  auto s2 = ch.Send(3, &exec);
+
+  REQUIRE(s0.IsSatisfied());
+  REQUIRE(s1.IsSatisfied());
+  REQUIRE(s2.IsEmpty());
+
+  auto r0 = ch.Receive(&exec);
+  REQUIRE(r0.IsSatisfied());
+
+  // the freed slot is taken by the waiting sender
+  exec.Run();
+  REQUIRE(s2.IsSatisfied());
+
+  std::vector<int> values;
+  auto r1 = ch.ReceiveMany(4, &exec);
+  r1.Then([&](Result<std::vector<int>>&& r) { values = r.PassResult(); },
+          &exec);
+  exec.Run();
+
+  REQUIRE(values == std::vector<int>{2, 3});
+}
+
+TEST_CASE("receive waits", "[channel]") {
+  MockExecutor exec;
+  Channel<std::unique_ptr<int>> ch(4);
+
+  int value = 0;
+  auto r = ch.Receive(&exec);
+  r.Then([&](Result<std::unique_ptr<int>>&& r) { value = *r.PassResult(); },
+         &exec);
+
+  exec.Run();
+  REQUIRE(r.IsEmpty());
+
+  REQUIRE(ch.Send(std::make_unique<int>(7), &exec).IsSatisfied());
+  REQUIRE(r.IsEmpty());
+
+  exec.Run();
+  REQUIRE(value == 7);
+}
+
+TEST_CASE("close and drain", "[channel]") {
+  MockExecutor exec;
+  Channel<int> ch(2);
+
+  ch.Send(1, &exec);
+  ch.Send(2, &exec);
+  auto blocked = ch.Send(3, &exec);
+
+  ch.Close();
+  exec.Run();
+
+  REQUIRE(blocked.IsUnsatisfied());
+  REQUIRE(ch.Send(4, &exec).IsUnsatisfied());
+
+  REQUIRE(ch.Receive(&exec).IsSatisfied());
+  REQUIRE(ch.Receive(&exec).IsSatisfied());
+
+  auto drained = ch.Receive(&exec);
+  exec.Run();
+  REQUIRE(drained.IsUnsatisfied());
+}
+
+TEST_CASE("close wakes receivers", "[channel]") {
+  MockExecutor exec;
+  Channel<int> ch(2);
+
+  auto r = ch.ReceiveMany(2, &exec);
+  ch.Close();
+  exec.Run();
+
+  REQUIRE(r.IsUnsatisfied());
+}
+
+TEST_CASE("destroy rejects waiters", "[channel]") {
+  MockExecutor exec;
+  Promise<void> blocked;
+  Promise<int> r;
+  {
+    Channel<int> full(2);
+    full.Send(1, &exec);
+    full.Send(2, &exec);
+    blocked = full.Send(3, &exec);
+
+    Channel<int> empty(2);
+    r = empty.Receive(&exec);
+  }
+  exec.Run();
+
+  REQUIRE(blocked.IsUnsatisfied());
+  REQUIRE(r.IsUnsatisfied());
+}
+
+TEST_CASE("concurrent waiting producers and consumers", "[channel]") {
+  static constexpr int kThreads = 4;
+  static constexpr int kCount = 5000;
+
+  // small, so both sides wait often
+  Channel<int> ch(2);
+  std::atomic<long> sum{0};
+  std::atomic<int> sent_count{0};
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&]() {
+      QueueExecutor exec;
+      for (int i = 1; i <= kCount; ++i) {
+        auto sent = ch.Send(i, &exec);
+        while (sent.IsEmpty()) {
+          exec.RunOne();
+        }
+        if (sent.IsSatisfied()) {
+          ++sent_count;
+        }
+      }
+    });
+    threads.emplace_back([&]() {
+      QueueExecutor exec;
+      for (int i = 1; i <= kCount; ++i) {
+        auto received = ch.Receive(&exec);
+        while (received.IsEmpty()) {
+          exec.RunOne();
+        }
+        received.Then([&](Result<int>&& r) { sum += r.GetResult(); }, &exec);
+        exec.RunOne();
+      }
+    });
+  }
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  REQUIRE(sent_count.load() == kThreads * kCount);
+  REQUIRE(sum.load() == 1L * kThreads * kCount * (kCount + 1) / 2);
+}
+
+TEST_CASE("concurrent producers and consumers", "[channel]") {
+  static constexpr int kThreads = 4;
+  static constexpr int kCount = 20000;
+
+  Channel<int> ch(64);
+  std::atomic<long> sum{0};
+  std::atomic<int> received{0};
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&]() {
+      for (int i = 1; i <= kCount; ++i) {
+        int value = i;
+        while (!ch.TrySend(value)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+    threads.emplace_back([&]() {
+      while (received.load() < kThreads * kCount) {
+        if (auto v = ch.TryReceive(); v) {
+          sum += *v;
+          ++received;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  REQUIRE(received.load() == kThreads * kCount);
+  REQUIRE(sum.load() == 1L * kThreads * kCount * (kCount + 1) / 2);
+}
+
+}  // namespace event
+}  // namespace base
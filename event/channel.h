@@ -0,0 +1,470 @@
+#pragma once
+
+#include <common/macros.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "basic.h"
+#include "executor.h"
+#include "promise.h"
+
+namespace base {
+namespace event {
+
+// |Channel| is a bounded multi-producer multi-consumer queue between stages
+// which may run on different executors.
+//
+// the buffer is a lock-free ring, see Dmitry Vyukov's bounded MPMC queue,
+// so |Send| and |Receive| only take the lock when the other side is waiting
+// or when they have to wait themselves. a waiting side gets a pending promise,
+// which is settled by a task posted to the executor passed along with the
+// call. the caller should pass the executor it runs on, so that the promise
+// is never touched by two threads at once.
+//
+// after |Close|, sending fails with |kErrorEventChannelClosed| and waiting
+// senders are rejected. the buffered values can still be received, receiving
+// from a drained and closed channel fails with |kErrorEventChannelClosed|.
+// destroying the channel closes it, and rejects whoever still waits.
+template <typename T>
+class Channel {
+ public:
+  // |capacity| is rounded up to a power of two
+  explicit Channel(std::size_t capacity);
+  ~Channel();
+
+  // resolved once |value| is in the buffer, pending while the buffer is full
+  Promise<void> Send(T value, Executor* executor);
+
+  // resolved with the oldest value, pending while the buffer is empty
+  Promise<T> Receive(Executor* executor);
+
+  // resolved with at least one and up to |n| values
+  Promise<std::vector<T>> ReceiveMany(std::size_t n, Executor* executor);
+
+  // non-waiting variants, |value| is left untouched on failure
+  bool TrySend(T& value);
+  std::optional<T> TryReceive();
+
+  void Close();
+  bool IsClosed() const { return closed_.load(std::memory_order_acquire); }
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+ private:
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    T* ptr() { return reinterpret_cast<T*>(storage); }
+  };
+
+  struct Sender {
+    Executor* executor;
+    std::optional<T> value;
+    Promise<void> done;
+  };
+
+  struct Receiver {
+    Executor* executor;
+    // 0 for |Receive|
+    std::size_t max_count;
+    std::vector<T> values;
+    std::optional<Promise<T>> one;
+    std::optional<Promise<std::vector<T>>> many;
+  };
+
+  using Wakeups = std::vector<std::function<void()>>;
+
+  bool Push(T& value);
+  bool Pop(std::optional<T>* value);
+
+  // hand buffered values to waiting receivers, and values of waiting senders
+  // to the buffer, until neither is possible. the receivers left waiting on
+  // a closed channel are rejected. must be called with lock held.
+  void Balance(Wakeups* wakeups);
+
+  void WakeSender(std::shared_ptr<Sender> sender, Wakeups* wakeups);
+  void WakeReceiver(std::shared_ptr<Receiver> receiver, Wakeups* wakeups);
+  void RejectSender(std::shared_ptr<Sender> sender, Wakeups* wakeups);
+  void RejectReceiver(std::shared_ptr<Receiver> receiver, Wakeups* wakeups);
+
+  // settle a waiter by |f| in its executor, once the lock is released
+  template <typename F>
+  static void Notify(Executor* executor, F&& f, Wakeups* wakeups);
+
+  // the fast path of the other side, take the lock only if someone waits
+  void BalanceIfWaiting();
+
+  static void Run(Wakeups* wakeups);
+
+  static Error ClosedError() {
+    return Err(kErrorEventChannelClosed,
+               Error::StaticMessage{"channel closed"});
+  }
+
+ private:
+  std::unique_ptr<Cell[]> cells_;
+  std::size_t mask_;
+
+  alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+  alignas(64) std::atomic<std::size_t> dequeue_pos_{0};
+
+  // number of senders/receivers waiting or about to wait
+  alignas(64) std::atomic<std::size_t> waiting_{0};
+  std::atomic<bool> closed_{false};
+
+  std::mutex mutex_;
+  std::deque<std::shared_ptr<Sender>> senders_;
+  std::deque<std::shared_ptr<Receiver>> receivers_;
+
+  DISALLOW_COPY_AND_ASSIGN(Channel);
+};
+
+template <typename T>
+Channel<T>::Channel(std::size_t capacity) {
+  std::size_t size = 2;
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  cells_.reset(new Cell[size]);
+  mask_ = size - 1;
+  for (std::size_t i = 0; i < size; ++i) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+// the waiters left are rejected as by |Close|, settling them does not refer
+// to the channel any more
+template <typename T>
+Channel<T>::~Channel() {
+  Close();
+
+  std::optional<T> value;
+  while (Pop(&value)) {
+  }
+}
+
+template <typename T>
+bool Channel<T>::Push(T& value) {
+  Cell* cell;
+  std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  for (;;) {
+    cell = &cells_[pos & mask_];
+    std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+    auto diff =
+        static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  ::new (cell->storage) T(std::move(value));
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+bool Channel<T>::Pop(std::optional<T>* value) {
+  Cell* cell;
+  std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+  for (;;) {
+    cell = &cells_[pos & mask_];
+    std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+    auto diff =
+        static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+    if (diff == 0) {
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  value->emplace(std::move(*cell->ptr()));
+  cell->ptr()->~T();
+  cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+bool Channel<T>::TrySend(T& value) {
+  if (IsClosed() || !Push(value)) {
+    return false;
+  }
+  BalanceIfWaiting();
+  return true;
+}
+
+template <typename T>
+std::optional<T> Channel<T>::TryReceive() {
+  std::optional<T> value;
+  if (Pop(&value)) {
+    BalanceIfWaiting();
+  }
+  return value;
+}
+
+template <typename T>
+Promise<void> Channel<T>::Send(T value, Executor* executor) {
+  if (TrySend(value)) {
+    return MkResolvedPromise();
+  }
+  if (IsClosed()) {
+    return MkRejectedPromise<void>(ClosedError());
+  }
+
+  Wakeups wakeups;
+  Promise<void> done;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // pairs with the fence in |BalanceIfWaiting|, either the retry below
+    // sees the freed slot, or the receiver sees us waiting.
+    waiting_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (IsClosed()) {
+      waiting_.fetch_sub(1, std::memory_order_relaxed);
+      return MkRejectedPromise<void>(ClosedError());
+    }
+
+    auto sender = std::make_shared<Sender>();
+    sender->executor = executor;
+    sender->value.emplace(std::move(value));
+    done = sender->done;
+
+    senders_.push_back(std::move(sender));
+    Balance(&wakeups);
+  }
+
+  Run(&wakeups);
+  return done;
+}
+
+template <typename T>
+Promise<T> Channel<T>::Receive(Executor* executor) {
+  if (auto value = TryReceive(); value) {
+    return MkResolvedPromise(std::move(*value));
+  }
+
+  Wakeups wakeups;
+  Promise<T> done;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    waiting_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    auto receiver = std::make_shared<Receiver>();
+    receiver->executor = executor;
+    receiver->max_count = 0;
+    done = receiver->one.emplace();
+
+    receivers_.push_back(std::move(receiver));
+    Balance(&wakeups);
+  }
+
+  Run(&wakeups);
+  return done;
+}
+
+template <typename T>
+Promise<std::vector<T>> Channel<T>::ReceiveMany(std::size_t n,
+                                                Executor* executor) {
+  DCHECK(n > 0);
+
+  std::vector<T> values;
+  for (std::optional<T> value; values.size() < n && Pop(&value);) {
+    values.push_back(std::move(*value));
+  }
+  if (!values.empty()) {
+    BalanceIfWaiting();
+    return MkResolvedPromise(std::move(values));
+  }
+
+  Wakeups wakeups;
+  Promise<std::vector<T>> done;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    waiting_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    auto receiver = std::make_shared<Receiver>();
+    receiver->executor = executor;
+    receiver->max_count = n;
+    done = receiver->many.emplace();
+
+    receivers_.push_back(std::move(receiver));
+    Balance(&wakeups);
+  }
+
+  Run(&wakeups);
+  return done;
+}
+
+template <typename T>
+void Channel<T>::Close() {
+  Wakeups wakeups;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_.exchange(true, std::memory_order_acq_rel)) {
+      return;
+    }
+
+    for (auto& sender : senders_) {
+      RejectSender(std::move(sender), &wakeups);
+    }
+    senders_.clear();
+
+    // the waiting receivers have what is buffered, the others are rejected
+    Balance(&wakeups);
+  }
+
+  Run(&wakeups);
+}
+
+template <typename T>
+void Channel<T>::BalanceIfWaiting() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+
+  Wakeups wakeups;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Balance(&wakeups);
+  }
+  Run(&wakeups);
+}
+
+template <typename T>
+void Channel<T>::Balance(Wakeups* wakeups) {
+  for (bool moved = true; moved;) {
+    moved = false;
+
+    while (!senders_.empty() && Push(*senders_.front()->value)) {
+      WakeSender(std::move(senders_.front()), wakeups);
+      senders_.pop_front();
+      moved = true;
+    }
+
+    while (!receivers_.empty()) {
+      auto& receiver = receivers_.front();
+      std::size_t max_count = std::max<std::size_t>(receiver->max_count, 1);
+      for (std::optional<T> value;
+           receiver->values.size() < max_count && Pop(&value);) {
+        receiver->values.push_back(std::move(*value));
+      }
+      if (receiver->values.empty()) {
+        break;
+      }
+
+      WakeReceiver(std::move(receiver), wakeups);
+      receivers_.pop_front();
+      moved = true;
+    }
+  }
+
+  // nothing more will arrive once drained
+  if (IsClosed()) {
+    for (auto& receiver : receivers_) {
+      RejectReceiver(std::move(receiver), wakeups);
+    }
+    receivers_.clear();
+  }
+}
+
+template <typename T>
+void Channel<T>::WakeSender(std::shared_ptr<Sender> sender, Wakeups* wakeups) {
+  waiting_.fetch_sub(1, std::memory_order_relaxed);
+  sender->value.reset();
+  auto executor = sender->executor;
+  Notify(executor, [sender = std::move(sender)]() { sender->done.Resolve(); },
+         wakeups);
+}
+
+template <typename T>
+void Channel<T>::WakeReceiver(std::shared_ptr<Receiver> receiver,
+                              Wakeups* wakeups) {
+  waiting_.fetch_sub(1, std::memory_order_relaxed);
+  auto executor = receiver->executor;
+  Notify(executor,
+         [receiver = std::move(receiver)]() {
+           if (receiver->one) {
+             receiver->one->Resolve(std::move(receiver->values.front()));
+           } else {
+             receiver->many->Resolve(std::move(receiver->values));
+           }
+         },
+         wakeups);
+}
+
+template <typename T>
+void Channel<T>::RejectSender(std::shared_ptr<Sender> sender,
+                              Wakeups* wakeups) {
+  waiting_.fetch_sub(1, std::memory_order_relaxed);
+  sender->value.reset();
+  auto executor = sender->executor;
+  Notify(executor,
+         [sender = std::move(sender)]() { sender->done.Reject(ClosedError()); },
+         wakeups);
+}
+
+template <typename T>
+void Channel<T>::RejectReceiver(std::shared_ptr<Receiver> receiver,
+                                Wakeups* wakeups) {
+  waiting_.fetch_sub(1, std::memory_order_relaxed);
+  auto executor = receiver->executor;
+  Notify(executor,
+         [receiver = std::move(receiver)]() {
+           if (receiver->one) {
+             receiver->one->Reject(ClosedError());
+           } else {
+             receiver->many->Reject(ClosedError());
+           }
+         },
+         wakeups);
+}
+
+template <typename T>
+template <typename F>
+void Channel<T>::Notify(Executor* executor, F&& f, Wakeups* wakeups) {
+  wakeups->emplace_back([executor, f = std::forward<F>(f)]() mutable {
+    if (executor) {
+      executor->Post(std::move(f));
+    } else {
+      f();
+    }
+  });
+}
+
+// wakeups run without the lock, a resolved promise may call back into the
+// channel when it has no executor.
+template <typename T>
+void Channel<T>::Run(Wakeups* wakeups) {
+  for (auto& wakeup : *wakeups) {
+    wakeup();
+  }
+}
+
+}  // namespace event
+}  // namespace base
@@ -0,0 +1,364 @@
+#include "executor-group.h"
+
+#include <common/common.h>
+#include <common/crash-handler.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <string>
+
+namespace base {
+namespace event {
+namespace {
+
+thread_local const ExecutorGroup* tls_group = nullptr;
+thread_local std::size_t tls_node = 0;
+
+// parse a kernel cpu list, e.g. "0-3,8-11"
+std::vector<int> ParseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+    auto dash = range.find('-');
+    int first = std::stoi(range.substr(0, dash));
+    int last = dash == std::string::npos ? first
+                                         : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+bool ReadLine(const std::string& path, std::string* line) {
+  std::ifstream in(path);
+  return in && std::getline(in, *line);
+}
+
+std::vector<int> AllowedCpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  if (cpus.empty()) {
+    cpus.resize(std::max(1u, std::thread::hardware_concurrency()));
+    std::iota(cpus.begin(), cpus.end(), 0);
+  }
+  return cpus;
+}
+
+void PinTo(std::thread* thread, int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  // not fatal, e.g. the cpu is not allowed in a container
+  pthread_setaffinity_np(thread->native_handle(), sizeof(set), &set);
+}
+
+}  // namespace
+
+ExecutorGroup::Topology ExecutorGroup::Topology::Detect() {
+  static const std::string kNodes = "/sys/devices/system/node/";
+
+  auto allowed = AllowedCpus();
+  auto IsAllowed = [&](int cpu) {
+    return std::find(allowed.begin(), allowed.end(), cpu) != allowed.end();
+  };
+
+  Topology topology;
+  std::vector<int> ids;
+
+  std::string online;
+  if (ReadLine(kNodes + "online", &online)) {
+    for (auto id : ParseCpuList(online)) {
+      std::string list;
+      if (!ReadLine(kNodes + "node" + std::to_string(id) + "/cpulist",
+                    &list)) {
+        continue;
+      }
+
+      std::vector<int> cpus;
+      for (auto cpu : ParseCpuList(list)) {
+        if (IsAllowed(cpu)) {
+          cpus.push_back(cpu);
+        }
+      }
+      if (!cpus.empty()) {
+        ids.push_back(id);
+        topology.nodes.push_back(std::move(cpus));
+      }
+    }
+  }
+
+  if (topology.nodes.empty()) {
+    topology.nodes.push_back(std::move(allowed));
+    return topology;
+  }
+
+  // the distance rows list every online node, keep the columns of ours
+  for (auto id : ids) {
+    std::string line;
+    if (!ReadLine(kNodes + "node" + std::to_string(id) + "/distance", &line)) {
+      topology.distances.clear();
+      break;
+    }
+
+    std::vector<int> row;
+    std::stringstream ss(line);
+    for (int d; ss >> d;) {
+      row.push_back(d);
+    }
+
+    std::vector<int> distances;
+    for (auto other : ids) {
+      distances.push_back(static_cast<std::size_t>(other) < row.size()
+                              ? row[other]
+                              : 0);
+    }
+    topology.distances.push_back(std::move(distances));
+  }
+  return topology;
+}
+
+ExecutorGroup::ExecutorGroup(std::size_t threads_per_node, Topology topology,
+                             bool pin) {
+  DCHECK(!topology.nodes.empty());
+
+  auto count = topology.nodes.size();
+  for (std::size_t i = 0; i < count; ++i) {
+    auto node = std::make_unique<Node>();
+    for (std::size_t j = 0; j < count; ++j) {
+      if (j != i) {
+        node->neighbors.push_back(j);
+      }
+    }
+
+    if (topology.distances.size() == count) {
+      auto& distances = topology.distances[i];
+      std::stable_sort(node->neighbors.begin(), node->neighbors.end(),
+                       [&](std::size_t a, std::size_t b) {
+                         return distances[a] < distances[b];
+                       });
+    }
+    nodes_.push_back(std::move(node));
+
+    for (auto cpu : topology.nodes[i]) {
+      if (cpu_nodes_.size() <= static_cast<std::size_t>(cpu)) {
+        cpu_nodes_.resize(cpu + 1, -1);
+      }
+      cpu_nodes_[cpu] = static_cast<int>(i);
+    }
+  }
+
+  for (std::size_t i = 0; i < count; ++i) {
+    auto& cpus = topology.nodes[i];
+    auto threads =
+        std::max<std::size_t>(threads_per_node ? threads_per_node : cpus.size(),
+                              1);
+    for (std::size_t t = 0; t < threads; ++t) {
+      workers_.emplace_back([this, i]() { Run(i); });
+      if (pin && !cpus.empty()) {
+        PinTo(&workers_.back(), cpus[t % cpus.size()]);
+      }
+    }
+  }
+}
+
+ExecutorGroup::~ExecutorGroup() {
+  stopped_.store(true, std::memory_order_relaxed);
+  for (auto& node : nodes_) {
+    {
+      std::lock_guard<std::mutex> lock(node->mutex);
+    }
+    node->cond.notify_all();
+  }
+
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+
+  // posted to a node whose workers have exited already, by a callback
+  // running in another node
+  std::function<void()> task;
+  for (bool ran = true; ran;) {
+    ran = false;
+    for (std::size_t i = 0; i < nodes_.size(); ++i) {
+      while (Pop(i, &task)) {
+        NO_EXCEPT(task());
+        ran = true;
+      }
+    }
+  }
+}
+
+void ExecutorGroup::Post(std::function<void()>&& f) {
+  auto node = next_.fetch_add(1, std::memory_order_relaxed) % nodes_.size();
+  Push(node, &f, 1);
+}
+
+void ExecutorGroup::PostBatch(std::function<void()>* tasks,
+                              std::size_t count) {
+  if (count == 0) {
+    return;
+  }
+  auto node = next_.fetch_add(1, std::memory_order_relaxed) % nodes_.size();
+  Push(node, tasks, count);
+}
+
+void ExecutorGroup::PostLocal(std::function<void()>&& f) {
+  auto node = CurrentNode();
+  if (node < 0) {
+    auto cpu = sched_getcpu();
+    if (cpu >= 0 && static_cast<std::size_t>(cpu) < cpu_nodes_.size()) {
+      node = cpu_nodes_[cpu];
+    }
+  }
+
+  if (node < 0) {
+    Post(std::move(f));
+  } else {
+    Push(node, &f, 1);
+  }
+}
+
+void ExecutorGroup::PostToNode(std::size_t node, std::function<void()>&& f) {
+  DCHECK(node < nodes_.size());
+  Push(node, &f, 1);
+}
+
+int ExecutorGroup::CurrentNode() const {
+  return tls_group == this ? static_cast<int>(tls_node) : -1;
+}
+
+void ExecutorGroup::Push(std::size_t index, std::function<void()>* tasks,
+                         std::size_t count) {
+  auto& node = *nodes_[index];
+  bool idle = false;
+  {
+    std::lock_guard<std::mutex> lock(node.mutex);
+    for (std::size_t i = 0; i < count; ++i) {
+      node.tasks.push_back(std::move(tasks[i]));
+    }
+    // pairs with |Run|, either we see an idle neighbor, or it sees the size
+    node.size.store(node.tasks.size(), std::memory_order_seq_cst);
+    idle = node.idle.load(std::memory_order_relaxed) > 0;
+  }
+  if (idle) {
+    node.cond.notify_one();
+    return;
+  }
+
+  // all busy, ask the nearest idle worker to steal it
+  for (auto neighbor : node.neighbors) {
+    auto& other = *nodes_[neighbor];
+    if (other.idle.load(std::memory_order_seq_cst) == 0) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(other.mutex);
+      ++other.steal_signals;
+    }
+    other.cond.notify_one();
+    return;
+  }
+}
+
+bool ExecutorGroup::Pop(std::size_t index, std::function<void()>* task) {
+  auto& node = *nodes_[index];
+  if (node.size.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+
+  bool wake_next = false;
+  {
+    std::lock_guard<std::mutex> lock(node.mutex);
+    if (node.tasks.empty()) {
+      return false;
+    }
+    *task = std::move(node.tasks.front());
+    node.tasks.pop_front();
+    node.size.store(node.tasks.size(), std::memory_order_relaxed);
+    wake_next = !node.tasks.empty() && node.idle.load() > 0;
+  }
+
+  // a batch wakes up a single worker, which passes it on
+  if (wake_next) {
+    node.cond.notify_one();
+  }
+  return true;
+}
+
+bool ExecutorGroup::Steal(std::size_t index, std::function<void()>* task) {
+  for (auto neighbor : nodes_[index]->neighbors) {
+    if (Pop(neighbor, task)) {
+      stolen_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ExecutorGroup::HasNeighborTasks(std::size_t index) const {
+  for (auto neighbor : nodes_[index]->neighbors) {
+    if (nodes_[neighbor]->size.load(std::memory_order_seq_cst) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ExecutorGroup::Run(std::size_t index) {
+  InstallCrashStack();
+
+  tls_group = this;
+  tls_node = index;
+
+  auto& node = *nodes_[index];
+  for (;;) {
+    std::function<void()> task;
+    if (Pop(index, &task) || Steal(index, &task)) {
+      NO_EXCEPT(task());
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(node.mutex);
+    if (node.tasks.empty() && stopped_.load(std::memory_order_relaxed)) {
+      break;
+    }
+
+    node.idle.fetch_add(1, std::memory_order_seq_cst);
+    if (HasNeighborTasks(index)) {
+      node.idle.fetch_sub(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    node.cond.wait(lock, [&]() {
+      return !node.tasks.empty() || node.steal_signals > 0 ||
+             stopped_.load(std::memory_order_relaxed);
+    });
+    node.idle.fetch_sub(1, std::memory_order_relaxed);
+
+    if (node.steal_signals > 0) {
+      --node.steal_signals;
+    }
+  }
+
+  tls_group = nullptr;
+}
+
+}  // namespace event
+}  // namespace base
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <common/macros.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "executor.h"
+
+namespace base {
+namespace event {
+
+// |ExecutorGroup| runs the posted callbacks on worker threads pinned to the
+// cores of each NUMA node, with one queue per node, so that a continuation
+// stays on the node where its promise state and captures were allocated.
+//
+// an idle worker steals from the other nodes, the nearest first. a post to a
+// node without idle workers wakes up an idle worker of the nearest node
+// instead, which then steals it.
+class ExecutorGroup : public Executor {
+ public:
+  struct Topology {
+    // the cpus of every node, indexed by node id
+    std::vector<std::vector<int>> nodes;
+    // |distances[i][j]| is the relative distance from node i to node j, as
+    // reported by the kernel, may be empty
+    std::vector<std::vector<int>> distances;
+
+    // the nodes with cpus the process may run on, a single node with all of
+    // them if the kernel does not tell
+    static Topology Detect();
+  };
+
+  // |threads_per_node| zero means one worker per cpu of the node
+  explicit ExecutorGroup(std::size_t threads_per_node = 0,
+                         Topology topology = Topology::Detect(),
+                         bool pin = true);
+
+  // the queued callbacks are run before the workers are joined
+  ~ExecutorGroup() override;
+
+  // spread over the nodes in turn
+  void Post(std::function<void()>&& f) override;
+  void PostBatch(std::function<void()>* tasks, std::size_t count) override;
+
+  // post to the node of the calling thread, either the node of the worker,
+  // or of the cpu it's running on
+  void PostLocal(std::function<void()>&& f);
+
+  void PostToNode(std::size_t node, std::function<void()>&& f);
+
+  std::size_t nodes() const { return nodes_.size(); }
+  std::size_t size() const { return workers_.size(); }
+
+  // the number of callbacks run by a worker of another node than posted to
+  std::size_t stolen() const { return stolen_.load(std::memory_order_relaxed); }
+
+  // the node of the worker of this group running in the calling thread, or
+  // -1 if it's not a worker
+  int CurrentNode() const;
+
+ private:
+  struct alignas(64) Node {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::function<void()>> tasks;
+    // the number of wakeups asking an idle worker to steal
+    std::size_t steal_signals{0};
+
+    std::atomic<std::size_t> size{0};
+    std::atomic<std::size_t> idle{0};
+
+    // the other nodes, the nearest first
+    std::vector<std::size_t> neighbors;
+  };
+
+  void Push(std::size_t node, std::function<void()>* tasks, std::size_t count);
+
+  bool Pop(std::size_t node, std::function<void()>* task);
+  bool Steal(std::size_t node, std::function<void()>* task);
+  bool HasNeighborTasks(std::size_t node) const;
+
+  void Run(std::size_t node);
+
+ private:
+  std::vector<std::unique_ptr<Node>> nodes_;
+  // the node of every cpu, -1 if unknown
+  std::vector<int> cpu_nodes_;
+
+  std::atomic<std::size_t> next_{0};
+  std::atomic<std::size_t> stolen_{0};
+  std::atomic<bool> stopped_{false};
+
+  std::vector<std::thread> workers_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(ExecutorGroup);
+};
+
+}  // namespace event
+}  // namespace base
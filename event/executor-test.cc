@@ -0,0 +1,699 @@
+#define CATCH_CONFIG_MAIN
+#include "executor.h"
+// pulls in common/check.h, which has to go before catch
+#include "bounded-executor.h"
+
+#include <catch-include.h>
+#include <common/crash-handler.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "executor-group.h"
+#include "instrumented-executor.h"
+#include "mock-executor.h"
+#include "priority-executor.h"
+#include "stall-detector.h"
+#include "strand.h"
+#include "thread-pool.h"
+
+namespace base {
+namespace event {
+
+TEST_CASE("thread pool", "[executor]") {
+  std::atomic<int> count{0};
+  {
+    ThreadPoolExecutor pool(4);
+    for (int i = 0; i < 1000; ++i) {
+      pool.Post([&]() { ++count; });
+    }
+  }
+  REQUIRE(count == 1000);
+}
+
+TEST_CASE("thread pool shutdown", "[executor]") {
+  // outlives the pool, whose last worker posts to it
+  QueueExecutor caller;
+  ThreadPoolExecutor pool(2);
+
+  std::atomic<int> count{0};
+  for (int i = 0; i < 100; ++i) {
+    pool.Post([&]() { ++count; });
+  }
+
+  // resolved by a hop to the caller, the workers are not held
+  bool quiesced = false;
+  auto done = pool.Shutdown(ShutdownMode::kDrain, &caller);
+  done.Then([&](Result<void>&& r) { quiesced = static_cast<bool>(r); },
+            &caller);
+
+  while (!quiesced) {
+    caller.RunOne();
+  }
+  REQUIRE(count == 100);
+
+  // dropped after the shutdown
+  pool.Post([&]() { ++count; });
+  REQUIRE(count == 100);
+}
+
+TEST_CASE("thread pool shutdown, racing posts", "[executor]") {
+  for (int i = 0; i < 100; ++i) {
+    QueueExecutor caller;
+    ThreadPoolExecutor pool(2);
+
+    // a callback posted while the workers are leaving is either run or
+    // dropped, it's never left in the queue once quiesced
+    auto token = std::make_shared<int>(0);
+    std::atomic<bool> stop{false};
+    std::thread poster([&, token]() {
+      while (!stop) {
+        pool.Post([token]() {});
+      }
+    });
+
+    bool quiesced = false;
+    auto done = pool.Shutdown(ShutdownMode::kDrain, &caller);
+    done.Then([&](Result<void>&& r) { quiesced = static_cast<bool>(r); },
+              &caller);
+    while (!quiesced) {
+      caller.RunOne();
+    }
+
+    stop = true;
+    poster.join();
+    REQUIRE(token.use_count() == 1);
+  }
+}
+
+TEST_CASE("thread pool shutdown, cancel", "[executor]") {
+  QueueExecutor caller;
+  ThreadPoolExecutor pool(1);
+
+  std::atomic<bool> started{false};
+  std::atomic<bool> release{false};
+  pool.Post([&]() {
+    started = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+  });
+  while (!started) {
+    std::this_thread::yield();
+  }
+
+  // the callback is queued behind the held worker
+  bool called = false;
+  Promise<int> p;
+  p.Then([&](Result<int>&& r) { called = true; }, &pool);
+  REQUIRE(p.Resolve(1));
+
+  std::atomic<int> count{0};
+  pool.Post([&]() { ++count; });
+
+  auto done = pool.Shutdown(ShutdownMode::kCancel, &caller);
+  REQUIRE(p.IsCancelled());
+
+  bool quiesced = false;
+  done.Then([&](Result<void>&& r) { quiesced = static_cast<bool>(r); },
+            &caller);
+
+  release = true;
+  while (!quiesced) {
+    caller.RunOne();
+  }
+
+  REQUIRE(!called);
+  REQUIRE(count == 0);
+}
+
+// read through a volatile, so the compiler can not tell it never stops
+volatile int g_overflow_limit = 1 << 30;
+
+// the frame is kept alive across the call, so it's not turned into a loop
+__attribute__((noinline)) int Overflow(int depth) {
+  if (depth == g_overflow_limit) {
+    return 0;
+  }
+  volatile char frame[256];
+  frame[0] = static_cast<char>(depth);
+  return Overflow(depth + 1) + frame[0];
+}
+
+TEST_CASE("thread pool crash stack", "[executor]") {
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+
+  auto child = fork();
+  REQUIRE(child >= 0);
+  if (child == 0) {
+    struct rlimit no_core = {0, 0};
+    setrlimit(RLIMIT_CORE, &no_core);
+    close(fds[0]);
+    // the handlers of catch are not chained to
+    for (auto signo : {SIGSEGV, SIGBUS, SIGABRT, SIGFPE}) {
+      signal(signo, SIG_DFL);
+    }
+    InstallCrashHandler(fds[1]);
+
+    // overflows the stack of a worker, not the one of this thread
+    ThreadPoolExecutor pool(1);
+    pool.Post([]() { Overflow(0); });
+    std::this_thread::sleep_for(std::chrono::seconds(10));
+    _exit(0);
+  }
+
+  close(fds[1]);
+  std::string report;
+  char buffer[4096];
+  for (ssize_t n; (n = read(fds[0], buffer, sizeof(buffer))) > 0;) {
+    report.append(buffer, static_cast<std::size_t>(n));
+  }
+  close(fds[0]);
+
+  int status = 0;
+  REQUIRE(waitpid(child, &status, 0) == child);
+  INFO(report);
+  REQUIRE(WIFSIGNALED(status));
+  REQUIRE(WTERMSIG(status) == SIGSEGV);
+  REQUIRE(report.rfind("*** SIGSEGV received at ", 0) == 0);
+}
+
+TEST_CASE("post batch", "[executor]") {
+  static constexpr int kBatch = 100;
+
+  std::atomic<int> count{0};
+  std::vector<std::function<void()>> tasks;
+  auto fill = [&]() {
+    tasks.clear();
+    for (int i = 0; i < kBatch; ++i) {
+      tasks.emplace_back([&]() { ++count; });
+    }
+  };
+
+  MockExecutor exec;
+  fill();
+  exec.PostBatch(tasks.data(), tasks.size());
+  REQUIRE(exec.queue.size() == kBatch);
+  exec.Run();
+  REQUIRE(count == kBatch);
+
+  {
+    ThreadPoolExecutor pool(4);
+    for (int i = 0; i < 10; ++i) {
+      fill();
+      pool.PostBatch(tasks.data(), tasks.size());
+    }
+  }
+  REQUIRE(count == kBatch * 11);
+}
+
+TEST_CASE("strand post batch", "[executor]") {
+  MockExecutor exec;
+  StrandExecutor strand(&exec);
+
+  std::vector<int> order;
+  std::vector<std::function<void()>> tasks;
+  for (int i = 0; i < 3; ++i) {
+    tasks.emplace_back([&, i]() { order.push_back(i); });
+  }
+  strand.PostBatch(tasks.data(), tasks.size());
+  strand.Post([&]() { order.push_back(3); });
+
+  // a single drain for the whole batch
+  REQUIRE(exec.queue.size() == 1);
+  exec.Run();
+  REQUIRE(order == std::vector<int>{0, 1, 2, 3});
+}
+
+TEST_CASE("bounded", "[executor]") {
+  MockExecutor exec;
+  BoundedExecutor bounded(&exec, 3);
+
+  std::vector<bool> signals;
+  bounded.SetWatermarks(2, 1, [&](bool overloaded) {
+    signals.push_back(overloaded);
+  });
+
+  int count = 0;
+  REQUIRE(bounded.TryPost([&]() { ++count; }) == PostStatus::kAccepted);
+  REQUIRE(signals.empty());
+  REQUIRE(bounded.TryPost([&]() { ++count; }) == PostStatus::kAccepted);
+  REQUIRE(signals == std::vector<bool>{true});
+  REQUIRE(bounded.IsOverloaded());
+  REQUIRE(bounded.TryPost([&]() { ++count; }) == PostStatus::kAccepted);
+  REQUIRE(bounded.TryPost([&]() { ++count; }) == PostStatus::kOverloaded);
+  REQUIRE(bounded.size() == 3);
+
+  auto rejected =
+      bounded.PostOrReject([]() -> Result<int> { return 1; }, &exec);
+  REQUIRE(rejected.IsPreRejected());
+
+  REQUIRE(exec.RunOne());
+  REQUIRE(signals.size() == 1);
+  REQUIRE(exec.RunOne());
+  REQUIRE(signals == std::vector<bool>{true, false});
+  REQUIRE(!bounded.IsOverloaded());
+
+  auto accepted =
+      bounded.PostOrReject([]() -> Result<int> { return 1; }, &exec);
+  exec.Run();
+
+  REQUIRE(count == 3);
+  REQUIRE(bounded.size() == 0);
+  REQUIRE(accepted.IsPreFulfilled());
+
+  Error error;
+  rejected.Then([&](Result<int>&& r) { error = r.PassError(); }, &exec);
+  exec.Run();
+  REQUIRE(error.code() == kErrorEventExecutorOverloaded);
+
+  // dropped unrun, e.g. by an executor shutting down
+  REQUIRE(bounded.TryPost([&]() { ++count; }) == PostStatus::kAccepted);
+  REQUIRE(bounded.TryPost([&]() { ++count; }) == PostStatus::kAccepted);
+  REQUIRE(bounded.IsOverloaded());
+  exec.queue.clear();
+  REQUIRE(bounded.size() == 0);
+  REQUIRE(!bounded.IsOverloaded());
+  REQUIRE(count == 3);
+}
+
+TEST_CASE("bounded post or reject, thread pool", "[executor]") {
+  static constexpr int kCount = 10000;
+
+  // outlives the pool, the results hop to it
+  QueueExecutor caller;
+  ThreadPoolExecutor pool(4);
+  BoundedExecutor bounded(&pool, kCount);
+
+  // attached by the caller while the workers settle the results
+  std::vector<int> calls(kCount, 0);
+  std::vector<Promise<int>> promises;
+  int settled = 0;
+  for (int i = 0; i < kCount; ++i) {
+    auto& p = promises.emplace_back(
+        bounded.PostOrReject([i]() -> Result<int> { return i; }, &caller));
+    p.Then(
+        [&](Result<int>&& r) {
+          ++calls[r.GetResult()];
+          ++settled;
+        },
+        &caller);
+  }
+
+  while (settled < kCount) {
+    caller.RunOne();
+  }
+  REQUIRE(std::all_of(calls.begin(), calls.end(),
+                      [](int n) { return n == 1; }));
+}
+
+TEST_CASE("bounded watermarks across threads", "[executor]") {
+  static constexpr int kThreads = 4;
+  static constexpr int kCount = 10000;
+
+  LocalExecutor local;
+  BoundedExecutor bounded(&local, kThreads);
+
+  // serialized by the executor, the crossings have to alternate
+  std::vector<bool> signals;
+  bounded.SetWatermarks(2, 1, [&](bool overloaded) {
+    signals.push_back(overloaded);
+  });
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < kCount; ++j) {
+        bounded.Post([]() {});
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  REQUIRE(bounded.size() == 0);
+  REQUIRE(!bounded.IsOverloaded());
+  for (std::size_t i = 0; i < signals.size(); ++i) {
+    REQUIRE(signals[i] == (i % 2 == 0));
+  }
+  REQUIRE(signals.size() % 2 == 0);
+}
+
+TEST_CASE("instrumented", "[executor]") {
+  MockExecutor exec;
+  InstrumentedExecutor instrumented(&exec, 2);
+
+  for (int i = 0; i < 4; ++i) {
+    instrumented.Post([]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+  // the depth of the queue
+  REQUIRE(instrumented.GetSnapshot().queued() == 4);
+  REQUIRE(exec.RunOne());
+  REQUIRE(instrumented.GetSnapshot().queued() == 3);
+  exec.Run();
+
+  auto snapshot = instrumented.GetSnapshot();
+  REQUIRE(snapshot.posted == 4);
+  REQUIRE(snapshot.started == 4);
+  REQUIRE(snapshot.queued() == 0);
+  REQUIRE(snapshot.sampled == 2);
+  REQUIRE(snapshot.run.count() == 2);
+  REQUIRE(snapshot.wait.count() == 2);
+  REQUIRE(snapshot.run.ValueAtPercentile(50) >= 2000000);
+  REQUIRE(snapshot.wait.Max() >= 2000000);
+
+  // forwarded untouched while disabled
+  instrumented.SetEnabled(false);
+  instrumented.Post([]() {});
+  exec.Run();
+  REQUIRE(instrumented.GetSnapshot().posted == 4);
+}
+
+TEST_CASE("instrumented, short lived", "[executor]") {
+  MockExecutor exec;
+
+  // the slot of a destroyed executor is taken over, its shard is not reused
+  for (int i = 0; i < 100; ++i) {
+    InstrumentedExecutor instrumented(&exec);
+    instrumented.Post([]() {});
+    exec.Run();
+    REQUIRE(instrumented.GetSnapshot().posted == 1);
+  }
+
+  std::uint32_t index = 0;
+  std::uint64_t id = 0;
+  {
+    InstanceSlot first;
+    index = first.index();
+    id = first.id();
+    REQUIRE(InstanceSlot::IsAlive(index, id));
+  }
+  REQUIRE(!InstanceSlot::IsAlive(index, id));
+
+  InstanceSlot second;
+  REQUIRE(second.index() == index);
+  REQUIRE(second.id() != id);
+}
+
+TEST_CASE("instrumented on a pool", "[executor]") {
+  auto pool = std::make_unique<ThreadPoolExecutor>(4);
+  InstrumentedExecutor instrumented(pool.get());
+
+  std::vector<std::thread> producers;
+  for (int t = 0; t < 4; ++t) {
+    producers.emplace_back([&]() {
+      for (int i = 0; i < 1000; ++i) {
+        instrumented.Post([]() {});
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  pool.reset();
+
+  auto snapshot = instrumented.GetSnapshot();
+  REQUIRE(snapshot.posted == 4000);
+  REQUIRE(snapshot.run.count() == 4000);
+  REQUIRE(snapshot.wait.count() == 4000);
+}
+
+TEST_CASE("stall detector", "[executor]") {
+  auto pool = std::make_unique<ThreadPoolExecutor>(2);
+  TimerWheel wheel;
+
+  std::vector<StallDetector::Stall> stalls;
+  StallDetector detector(
+      pool.get(), &wheel, 10, std::chrono::milliseconds(20),
+      [&](const StallDetector::Stall& stall) { stalls.push_back(stall); });
+
+  std::atomic<bool> started{false};
+  std::atomic<bool> release{false};
+  detector.Post([&]() {
+    started = true;
+    // blocked, like on a synchronous disk I/O
+    while (!release) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  detector.Post([]() {});
+
+  while (!started) {
+    std::this_thread::yield();
+  }
+  wheel.Advance(10);
+  auto early = stalls.size();
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  wheel.Advance(10);
+  // the stack is collected, and the stall reported, on a later tick
+  REQUIRE(stalls.empty());
+  for (int i = 0; i < 1000 && stalls.empty(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    wheel.Advance(10);
+  }
+  // reported once
+  wheel.Advance(10);
+
+  release = true;
+  pool.reset();
+
+  REQUIRE(early == 0);
+  REQUIRE(stalls.size() == 1);
+  REQUIRE(stalls[0].running >= std::chrono::milliseconds(20));
+  REQUIRE(stalls[0].post_site != nullptr);
+#if !defined(__SANITIZE_THREAD__)
+  // the unwinder finds no frames in a signal handler under tsan
+  REQUIRE(!stalls[0].stack.empty());
+  // from the interrupted frame, not the handler
+  REQUIRE(stalls[0].stack.find("OnCaptureSignal") == std::string::npos);
+#endif
+}
+
+TEST_CASE("executor group", "[executor]") {
+  ExecutorGroup::Topology topology;
+  topology.nodes = {{0}, {0}};
+
+  std::atomic<int> count{0};
+  std::atomic<int> local{0};
+  {
+    ExecutorGroup group(2, topology, false);
+    REQUIRE(group.nodes() == 2);
+    REQUIRE(group.size() == 4);
+    REQUIRE(group.CurrentNode() == -1);
+
+    for (int i = 0; i < 1000; ++i) {
+      group.Post([&]() {
+        group.PostLocal([&]() { ++local; });
+        ++count;
+      });
+    }
+  }
+  REQUIRE(count == 1000);
+  REQUIRE(local == 1000);
+
+  REQUIRE(!ExecutorGroup::Topology::Detect().nodes.empty());
+}
+
+TEST_CASE("executor group stealing", "[executor]") {
+  ExecutorGroup::Topology topology;
+  topology.nodes = {{0}, {0}};
+  ExecutorGroup group(1, topology, false);
+
+  // the blocker maybe stolen as well, block whichever node runs it
+  std::atomic<int> blocked{-1};
+  std::atomic<bool> release{false};
+  group.PostToNode(0, [&]() {
+    blocked = group.CurrentNode();
+    while (!release) {
+      std::this_thread::yield();
+    }
+  });
+  while (blocked < 0) {
+    std::this_thread::yield();
+  }
+
+  // the worker of the blocked node is busy, the idle one steals them
+  std::atomic<int> count{0};
+  std::atomic<int> remote{0};
+  for (int i = 0; i < 100; ++i) {
+    group.PostToNode(blocked, [&]() {
+      if (group.CurrentNode() != blocked) ++remote;
+      ++count;
+    });
+  }
+  while (count < 100) {
+    std::this_thread::yield();
+  }
+  release = true;
+
+  REQUIRE(remote == 100);
+  REQUIRE(group.stolen() >= 100);
+}
+
+TEST_CASE("trampoline", "[executor]") {
+  TrampolineExecutor exec;
+
+  std::vector<int> order;
+  exec.Post([&]() {
+    order.push_back(0);
+    exec.Post([&]() {
+      order.push_back(2);
+      exec.Post([&]() { order.push_back(4); });
+    });
+    exec.Post([&]() { order.push_back(3); });
+    order.push_back(1);
+  });
+
+  REQUIRE(order == std::vector<int>{0, 1, 2, 3, 4});
+  REQUIRE(!TrampolineExecutor::IsRunningInThisThread());
+
+  // deep enough to overflow the stack if the posts nested
+  std::size_t depth = 0;
+  std::function<void()> step = [&]() {
+    if (++depth < 1000000) exec.Post([&]() { step(); });
+  };
+  exec.Post([&]() { step(); });
+  REQUIRE(depth == 1000000);
+}
+
+TEST_CASE("strand budget", "[executor]") {
+  MockExecutor exec;
+  StrandExecutor strand(&exec, 2);
+
+  std::vector<int> order;
+  for (int i = 0; i < 5; ++i) {
+    strand.Post([&, i]() {
+      REQUIRE(strand.IsRunningInThisThread());
+      order.push_back(i);
+    });
+  }
+
+  // a single drain is scheduled, and it yields after two callbacks
+  REQUIRE(exec.queue.size() == 1);
+  REQUIRE(exec.RunOne());
+  REQUIRE(order == std::vector<int>{0, 1});
+  REQUIRE(exec.queue.size() == 1);
+
+  exec.Run();
+  REQUIRE(order == std::vector<int>{0, 1, 2, 3, 4});
+  REQUIRE(exec.count == 3);
+  REQUIRE(!strand.IsRunningInThisThread());
+}
+
+TEST_CASE("strand serializes on a pool", "[executor]") {
+  static constexpr int kThreads = 4;
+  static constexpr int kCount = 10000;
+
+  // the pool is joined before the strand goes away
+  auto pool = std::make_unique<ThreadPoolExecutor>(kThreads);
+  StrandExecutor strand(pool.get(), 16);
+
+  std::atomic<int> running{0};
+  std::atomic<bool> overlapped{false};
+  int counter = 0;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool finished = false;
+
+  std::vector<std::thread> producers;
+  for (int t = 0; t < kThreads; ++t) {
+    producers.emplace_back([&]() {
+      for (int i = 0; i < kCount; ++i) {
+        strand.Post([&]() {
+          if (running.fetch_add(1) != 0) overlapped = true;
+          if (++counter == kThreads * kCount) {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            cond.notify_one();
+          }
+          running.fetch_sub(1);
+        });
+      }
+    });
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  cond.wait(lock, [&]() { return finished; });
+  pool.reset();
+
+  REQUIRE(counter == kThreads * kCount);
+  REQUIRE(!overlapped);
+}
+
+TEST_CASE("priority lanes", "[executor]") {
+  MockExecutor exec;
+  PriorityExecutor priority(&exec, std::chrono::hours(1));
+
+  std::vector<int> order;
+  priority.Post(Priority::kLow, [&]() { order.push_back(3); });
+  std::vector<std::function<void()>> batch{[&]() { order.push_back(2); },
+                                           [&]() { order.push_back(2); }};
+  priority.PostBatch(batch.data(), batch.size());
+  priority.Post(Priority::kHigh, [&]() { order.push_back(1); });
+
+  auto now = PriorityExecutor::Clock::now();
+  priority.PostWithDeadline(now + std::chrono::seconds(2),
+                            [&]() { order.push_back(-1); });
+  priority.PostWithDeadline(now + std::chrono::seconds(1),
+                            [&]() { order.push_back(-2); });
+
+  exec.Run();
+  REQUIRE(order == std::vector<int>{-2, -1, 1, 2, 2, 3});
+}
+
+TEST_CASE("priority aging", "[executor]") {
+  MockExecutor exec;
+  PriorityExecutor priority(&exec, std::chrono::milliseconds(1));
+
+  std::vector<int> order;
+  priority.Post(Priority::kLow, [&]() { order.push_back(3); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  priority.Post(Priority::kHigh, [&]() { order.push_back(1); });
+
+  // the low priority callback has waited long enough to go first
+  exec.Run();
+  REQUIRE(order == std::vector<int>{3, 1});
+}
+
+TEST_CASE("priority on a pool", "[executor]") {
+  std::atomic<int> count{0};
+  {
+    auto pool = std::make_unique<ThreadPoolExecutor>(4);
+    PriorityExecutor priority(pool.get());
+
+    auto deadline = PriorityExecutor::Clock::now();
+    for (int i = 0; i < 3000; ++i) {
+      if (i % 4 == 3) {
+        priority.PostWithDeadline(deadline, [&]() { ++count; });
+      } else {
+        priority.Post(static_cast<Priority>(i % 4), [&]() { ++count; });
+      }
+    }
+    pool.reset();
+  }
+  REQUIRE(count == 3000);
+}
+
+}  // namespace event
+}  // namespace base
@@ -0,0 +1,85 @@
+#include "executor.h"
+
+#include <common/common.h>
+
+#include <array>
+#include <deque>
+
+namespace base {
+namespace event {
+namespace {
+
+// FIFO of the deferred callbacks, the fixed ring covers shallow chains without
+// allocation, it spills into |overflow| once full.
+class Trampoline {
+ public:
+  bool IsRunning() const { return running_; }
+
+  void Run(std::function<void()>&& f) {
+    running_ = true;
+    NO_EXCEPT(f());
+
+    std::function<void()> next;
+    while (Pop(&next)) {
+      NO_EXCEPT(next());
+      next = nullptr;
+    }
+    running_ = false;
+  }
+
+  void Push(std::function<void()>&& f) {
+    if (!overflow_.empty() || size_ == kInlineSize) {
+      overflow_.push_back(std::move(f));
+      return;
+    }
+    ring_[(head_ + size_++) % kInlineSize] = std::move(f);
+  }
+
+ private:
+  bool Pop(std::function<void()>* f) {
+    if (size_ > 0) {
+      *f = std::move(ring_[head_]);
+      ring_[head_] = nullptr;
+      head_ = (head_ + 1) % kInlineSize;
+      --size_;
+      return true;
+    }
+    if (!overflow_.empty()) {
+      *f = std::move(overflow_.front());
+      overflow_.pop_front();
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  static constexpr std::size_t kInlineSize = 16;
+
+  bool running_{false};
+
+  std::array<std::function<void()>, kInlineSize> ring_;
+  std::size_t head_{0};
+  std::size_t size_{0};
+
+  // everything in |overflow_| is posted after what's in |ring_|
+  std::deque<std::function<void()>> overflow_;
+};
+
+thread_local Trampoline tls_trampoline;
+
+}  // namespace
+
+void TrampolineExecutor::Post(std::function<void()>&& f) {
+  if (tls_trampoline.IsRunning()) {
+    tls_trampoline.Push(std::move(f));
+  } else {
+    tls_trampoline.Run(std::move(f));
+  }
+}
+
+bool TrampolineExecutor::IsRunningInThisThread() {
+  return tls_trampoline.IsRunning();
+}
+
+}  // namespace event
+}  // namespace base
@@ -1,10 +1,19 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 
 namespace base {
 namespace event {
 
+enum class ShutdownMode : std::uint8_t {
+  // run the queued callbacks, and the ones they post, before stopping
+  kDrain,
+  // drop the queued callbacks, the promises waiting for them are cancelled
+  kCancel,
+};
+
 // |Executor| provides the execution environment for function/callback. the
 // underlaying implementation maybe athread pool and so on
 class Executor {
@@ -13,6 +22,15 @@ class Executor {
 
   // run a function/callback on appropriate time
   virtual void Post(std::function<void()>&&) = 0;
+
+  // post |count| functions/callbacks at once, they are moved out of |tasks|.
+  // the implementation may enqueue them together, and wakes up the workers
+  // once, instead of once per callback.
+  virtual void PostBatch(std::function<void()>* tasks, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      Post(std::move(tasks[i]));
+    }
+  }
 };
 
 class LocalExecutor : public Executor {
@@ -21,5 +39,18 @@ class LocalExecutor : public Executor {
   void Post(std::function<void()>&& f) override { f(); }
 };
 
+// |TrampolineExecutor| runs the function/callback in place as well, but the
+// ones posted while it's running are queued in a thread local buffer, and run
+// one after another once the outer one returns. so a chain of callbacks
+// settled synchronously runs in constant stack depth.
+class TrampolineExecutor : public Executor {
+ public:
+  void Post(std::function<void()>&& f) override;
+
+  // whether a callback posted to any |TrampolineExecutor| is running in the
+  // calling thread
+  static bool IsRunningInThisThread();
+};
+
 }  // namespace event
 }  // namespace base
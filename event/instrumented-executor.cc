@@ -0,0 +1,153 @@
+#include "instrumented-executor.h"
+
+#include <common/common.h>
+
+#include <utility>
+
+namespace base {
+namespace event {
+// written by its own thread only, so the counters are bumped by plain load
+// and store, and read by |GetSnapshot| from any thread.
+struct InstrumentedExecutor::Shard {
+  using Counter = std::atomic<std::uint64_t>;
+
+  std::size_t countdown{0};
+
+  Counter posted{0};
+  Counter started{0};
+  Counter sampled{0};
+
+  Counter wait_sum{0};
+  Counter run_sum{0};
+  Counter wait[Histogram::kBuckets]{};
+  Counter run[Histogram::kBuckets]{};
+
+  static void Bump(Counter* counter, std::uint64_t n = 1) {
+    counter->store(counter->load(std::memory_order_relaxed) + n,
+                   std::memory_order_relaxed);
+  }
+
+  void Record(Counter* buckets, Counter* sum, Clock::duration d) {
+    auto ns = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    Bump(&buckets[Histogram::IndexOf(ns)]);
+    Bump(sum, ns);
+  }
+
+  static void Merge(const Counter* buckets, const Counter& sum,
+                    Histogram* histogram) {
+    for (std::size_t i = 0; i < Histogram::kBuckets; ++i) {
+      if (auto n = buckets[i].load(std::memory_order_relaxed); n) {
+        histogram->Add(i, n);
+      }
+    }
+    histogram->AddSum(sum.load(std::memory_order_relaxed));
+  }
+};
+
+InstrumentedExecutor::InstrumentedExecutor(Executor* executor,
+                                           std::size_t sample_every)
+    : executor_(executor), sample_every_(sample_every) {
+  DCHECK(executor_);
+  DCHECK(sample_every_ > 0);
+}
+
+InstrumentedExecutor::~InstrumentedExecutor() {}
+
+void InstrumentedExecutor::Post(std::function<void()>&& f) {
+  if (!IsEnabled()) {
+    executor_->Post(std::move(f));
+    return;
+  }
+  executor_->Post(Wrap(LocalShard(), std::move(f)));
+}
+
+void InstrumentedExecutor::PostBatch(std::function<void()>* tasks,
+                                     std::size_t count) {
+  if (IsEnabled()) {
+    auto shard = LocalShard();
+    for (std::size_t i = 0; i < count; ++i) {
+      tasks[i] = Wrap(shard, std::move(tasks[i]));
+    }
+  }
+  executor_->PostBatch(tasks, count);
+}
+
+std::function<void()> InstrumentedExecutor::Wrap(Shard* shard,
+                                                 std::function<void()>&& f) {
+  Shard::Bump(&shard->posted);
+  if (shard->countdown > 0) {
+    --shard->countdown;
+    return [this, f = std::move(f)]() {
+      Shard::Bump(&LocalShard()->started);
+      f();
+    };
+  }
+  shard->countdown = sample_every_ - 1;
+
+  return [this, f = std::move(f), posted = Clock::now()]() {
+    Shard::Bump(&LocalShard()->started);
+    auto start = Clock::now();
+    f();
+    auto end = Clock::now();
+
+    auto shard = LocalShard();
+    shard->Record(shard->wait, &shard->wait_sum, start - posted);
+    shard->Record(shard->run, &shard->run_sum, end - start);
+    Shard::Bump(&shard->sampled);
+  };
+}
+
+InstrumentedExecutor::Shard* InstrumentedExecutor::LocalShard() {
+  // the shards of the executors this thread has touched, indexed by their
+  // slots. the entries of the destroyed executors are dropped on a miss, or
+  // overwritten by the executor taking the slot over.
+  struct Entry {
+    std::uint64_t id{0};
+    Shard* shard{nullptr};
+  };
+  thread_local std::vector<Entry> tls_shards;
+
+  auto index = slot_.index();
+  if (index < tls_shards.size() && tls_shards[index].id == slot_.id()) {
+    return tls_shards[index].shard;
+  }
+
+  for (std::size_t i = 0; i < tls_shards.size(); ++i) {
+    auto& entry = tls_shards[i];
+    if (entry.id != 0 && !InstanceSlot::IsAlive(i, entry.id)) {
+      entry = Entry{};
+    }
+  }
+  while (!tls_shards.empty() && tls_shards.back().id == 0) {
+    tls_shards.pop_back();
+  }
+  if (index >= tls_shards.size()) {
+    tls_shards.resize(index + 1);
+  }
+
+  auto shard = new Shard;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shards_.emplace_back(shard);
+  }
+  tls_shards[index] = Entry{slot_.id(), shard};
+  return shard;
+}
+
+InstrumentedExecutor::Snapshot InstrumentedExecutor::GetSnapshot() const {
+  Snapshot snapshot;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& shard : shards_) {
+    snapshot.posted += shard->posted.load(std::memory_order_relaxed);
+    snapshot.started += shard->started.load(std::memory_order_relaxed);
+    snapshot.sampled += shard->sampled.load(std::memory_order_relaxed);
+    Shard::Merge(shard->wait, shard->wait_sum, &snapshot.wait);
+    Shard::Merge(shard->run, shard->run_sum, &snapshot.run);
+  }
+  return snapshot;
+}
+
+}  // namespace event
+}  // namespace base
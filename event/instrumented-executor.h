@@ -0,0 +1,88 @@
+#pragma once
+
+#include <common/histogram.h>
+#include <common/instance-slot.h>
+#include <common/macros.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "executor.h"
+
+namespace base {
+namespace event {
+
+// |InstrumentedExecutor| measures the callbacks posted to another executor,
+// how long they wait in its queue, and how long they run, so that a
+// saturated executor can be told apart from slow callbacks.
+//
+// every callback is counted at post and once it starts to run, the ones
+// posted but not started yet are the depth of the queue. one in every
+// |sample_every| callbacks is timestamped at post as well. the samples are recorded into histograms owned by the
+// recording thread, in nanoseconds, which are merged by |GetSnapshot|. while
+// disabled, the callbacks are forwarded as they are.
+//
+// the executor must outlive the callbacks it has posted.
+class InstrumentedExecutor : public Executor {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Snapshot {
+    std::uint64_t posted{0};
+    std::uint64_t started{0};
+    std::uint64_t sampled{0};
+    Histogram wait;
+    Histogram run;
+
+    // the callbacks waiting in the queue, the ones dropped unrun by the
+    // executor are never started, so they are counted as well
+    std::uint64_t queued() const {
+      return posted > started ? posted - started : 0;
+    }
+  };
+
+  explicit InstrumentedExecutor(Executor* executor,
+                                std::size_t sample_every = 1);
+  ~InstrumentedExecutor() override;
+
+  void Post(std::function<void()>&& f) override;
+  void PostBatch(std::function<void()>* tasks, std::size_t count) override;
+
+  void SetEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+  }
+  bool IsEnabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // merged from all threads, the counters of a running callback are not
+  // included yet
+  Snapshot GetSnapshot() const;
+
+ private:
+  struct Shard;
+
+  // the shard of the calling thread
+  Shard* LocalShard();
+
+  // wrap |f| to count its start, and record its timings if it's sampled
+  std::function<void()> Wrap(Shard* shard, std::function<void()>&& f);
+
+ private:
+  Executor* executor_;
+  std::size_t sample_every_;
+  std::atomic<bool> enabled_{true};
+
+  // indexes the thread local shard caches
+  InstanceSlot slot_;
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(InstrumentedExecutor);
+};
+
+}  // namespace event
+}  // namespace base
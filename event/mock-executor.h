@@ -0,0 +1,72 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+
+#include "executor.h"
+
+namespace base {
+namespace event {
+
+// |MockExecutor| queues the posted callbacks until the test runs them
+struct MockExecutor : public Executor {
+  using Callback = std::function<void()>;
+  std::size_t count{0};
+  std::list<Callback> queue;
+
+  void Post(Callback&& f) { queue.push_back(std::move(f)); }
+
+  void Run() {
+    while (!queue.empty()) {
+      auto cb = std::move(queue.front());
+      queue.pop_front();
+      cb();
+      ++count;
+    }
+  }
+
+  bool RunOne() {
+    if (!queue.empty()) {
+      auto cb = std::move(queue.front());
+      queue.pop_front();
+      cb();
+      ++count;
+      return true;
+    }
+    return false;
+  }
+};
+
+// |QueueExecutor| queues the callbacks posted by any thread, until the thread
+// owning it runs them
+struct QueueExecutor : public Executor {
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<std::function<void()>> queue;
+
+  void Post(std::function<void()>&& f) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push_back(std::move(f));
+    }
+    cond.notify_one();
+  }
+
+  // wait for a callback, and run it
+  void RunOne() {
+    std::function<void()> f;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [this]() { return !queue.empty(); });
+      f = std::move(queue.front());
+      queue.pop_front();
+    }
+    f();
+  }
+};
+
+}  // namespace event
+}  // namespace base
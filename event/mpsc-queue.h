@@ -0,0 +1,103 @@
+#pragma once
+
+#include <common/macros.h>
+#include <common/object-pool.h>
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace base {
+namespace event {
+
+// |MpscQueue| is an unbounded multi-producer single-consumer queue, see Dmitry
+// Vyukov's intrusive MPSC node-based queue. pushing is a single exchange and
+// never blocks. popping may transiently fail while a producer is between its
+// two steps, the caller should retry if it knows the queue is not empty.
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue() {
+    auto stub = ObjectPool<Node>::New();
+    head_.store(stub, std::memory_order_relaxed);
+    tail_ = stub;
+  }
+
+  ~MpscQueue() {
+    while (PopNode()) {
+    }
+    ObjectPool<Node>::Delete(tail_);
+  }
+
+  void Push(T&& value) {
+    auto node = ObjectPool<Node>::New();
+    node->value = std::move(value);
+
+    auto prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // push |count| values by a single exchange, they are moved out of |values|
+  void PushBatch(T* values, std::size_t count) {
+    if (count == 0) {
+      return;
+    }
+
+    auto first = ObjectPool<Node>::New();
+    first->value = std::move(values[0]);
+    auto last = first;
+    for (std::size_t i = 1; i < count; ++i) {
+      auto node = ObjectPool<Node>::New();
+      node->value = std::move(values[i]);
+      last->next.store(node, std::memory_order_relaxed);
+      last = node;
+    }
+
+    auto prev = head_.exchange(last, std::memory_order_acq_rel);
+    prev->next.store(first, std::memory_order_release);
+  }
+
+  // the following are for the single consumer only
+
+  bool Pop(T* value) {
+    auto node = PopNode();
+    if (!node) {
+      return false;
+    }
+    *value = std::move(node->value);
+    return true;
+  }
+
+  // the value to be popped next, maybe null while a push is in progress
+  T* Peek() const {
+    auto next = tail_->next.load(std::memory_order_acquire);
+    return next ? &next->value : nullptr;
+  }
+
+ private:
+  struct Node {
+    std::atomic<Node*> next{nullptr};
+    T value;
+  };
+
+  // the popped node becomes the new stub, its value is moved out
+  Node* PopNode() {
+    auto next = tail_->next.load(std::memory_order_acquire);
+    if (!next) {
+      return nullptr;
+    }
+    ObjectPool<Node>::Delete(tail_);
+    tail_ = next;
+    return next;
+  }
+
+ private:
+  // producers push at |head_|, the consumer pops after |tail_|
+  alignas(64) std::atomic<Node*> head_;
+  alignas(64) Node* tail_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(MpscQueue);
+};
+
+}  // namespace event
+}  // namespace base
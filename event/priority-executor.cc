@@ -0,0 +1,136 @@
+#include "priority-executor.h"
+
+#include <common/common.h>
+
+#include <limits>
+#include <thread>
+
+namespace base {
+namespace event {
+
+PriorityExecutor::PriorityExecutor(Executor* executor, Clock::duration aging)
+    : executor_(executor), aging_(aging) {
+  DCHECK(executor_);
+}
+
+void PriorityExecutor::Post(std::function<void()>&& f) {
+  Post(Priority::kNormal, std::move(f));
+}
+
+void PriorityExecutor::PostBatch(std::function<void()>* tasks,
+                                 std::size_t count) {
+  if (count == 0) {
+    return;
+  }
+
+  auto now = Clock::now();
+  std::vector<Entry> entries(count);
+  std::vector<std::function<void()>> dispatches(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    entries[i] = Entry{std::move(tasks[i]), now};
+    dispatches[i] = [this]() { Dispatch(); };
+  }
+
+  auto& lane = lanes_[static_cast<std::size_t>(Priority::kNormal)];
+  lane.entries.PushBatch(entries.data(), count);
+
+  executor_->PostBatch(dispatches.data(), count);
+}
+
+void PriorityExecutor::Post(Priority priority, std::function<void()>&& f) {
+  auto& lane = lanes_[static_cast<std::size_t>(priority)];
+  lane.entries.Push(Entry{std::move(f), Clock::now()});
+
+  executor_->Post([this]() { Dispatch(); });
+}
+
+void PriorityExecutor::PostWithDeadline(Clock::time_point deadline,
+                                        std::function<void()>&& f) {
+  {
+    std::lock_guard<std::mutex> lock(deadline_mutex_);
+    deadlines_.push(Deadline{std::move(f), Clock::now(), deadline});
+  }
+  deadline_count_.fetch_add(1, std::memory_order_release);
+
+  executor_->Post([this]() { Dispatch(); });
+}
+
+std::int64_t PriorityExecutor::Age(std::int64_t rank,
+                                   Clock::time_point enqueued,
+                                   Clock::time_point now) const {
+  if (aging_.count() <= 0 || now <= enqueued) {
+    return rank;
+  }
+  return rank - static_cast<std::int64_t>((now - enqueued) / aging_);
+}
+
+// every dispatch is matched by one posted callback, which maybe not linked
+// into its lane yet. so retry until one callback is run.
+void PriorityExecutor::Dispatch() {
+  static constexpr std::size_t kNone = std::numeric_limits<std::size_t>::max();
+
+  for (;;) {
+    auto now = Clock::now();
+
+    std::size_t best = kNone;
+    std::int64_t best_rank = std::numeric_limits<std::int64_t>::max();
+
+    if (deadline_count_.load(std::memory_order_acquire) > 0) {
+      std::lock_guard<std::mutex> lock(deadline_mutex_);
+      if (!deadlines_.empty()) {
+        best = kNumLanes;
+        best_rank = Age(kDeadlineRank, deadlines_.top().enqueued, now);
+      }
+    }
+
+    for (std::size_t i = 0; i < kNumLanes; ++i) {
+      std::lock_guard<std::mutex> lock(lanes_[i].consumer);
+      if (auto head = lanes_[i].entries.Peek(); head) {
+        auto rank = Age(static_cast<std::int64_t>(i), head->enqueued, now);
+        if (rank < best_rank) {
+          best = i;
+          best_rank = rank;
+        }
+      }
+    }
+
+    if (best == kNumLanes) {
+      if (TryRunDeadline()) return;
+    } else if (best != kNone) {
+      if (TryRunLane(best)) return;
+    }
+    std::this_thread::yield();
+  }
+}
+
+bool PriorityExecutor::TryRunLane(std::size_t lane) {
+  Entry entry;
+  {
+    std::lock_guard<std::mutex> lock(lanes_[lane].consumer);
+    if (!lanes_[lane].entries.Pop(&entry)) {
+      return false;
+    }
+  }
+  NO_EXCEPT(entry.task());
+  return true;
+}
+
+bool PriorityExecutor::TryRunDeadline() {
+  std::function<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(deadline_mutex_);
+    if (deadlines_.empty()) {
+      return false;
+    }
+    // the top is const, it is moved out right before popping
+    task = std::move(const_cast<Deadline&>(deadlines_.top()).task);
+    deadlines_.pop();
+  }
+  deadline_count_.fetch_sub(1, std::memory_order_relaxed);
+
+  NO_EXCEPT(task());
+  return true;
+}
+
+}  // namespace event
+}  // namespace base
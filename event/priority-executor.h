@@ -0,0 +1,107 @@
+#pragma once
+
+#include <common/macros.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+#include "executor.h"
+#include "mpsc-queue.h"
+
+namespace base {
+namespace event {
+
+enum class Priority : std::uint8_t {
+  kHigh,
+  kNormal,
+  kLow,
+};
+
+// |PriorityExecutor| orders the callbacks posted to it before they run on
+// another executor. there is one lane per |Priority|, and an
+// earliest-deadline-first lane for callbacks posted with a deadline.
+//
+// every post schedules one dispatch on the underlying executor, and the
+// dispatch runs the most urgent callback at that time rather than the one it
+// was scheduled for. the deadline lane goes first, then the priority lanes in
+// order. to prevent starvation, a callback gains one rank for each |aging|
+// period it has waited, so that a low priority callback waiting long enough
+// overtakes the fresh high priority and deadline ones.
+//
+// the priority lanes are lock-free on the posting side, each one has its own
+// consumer lock, and only the deadline lane is a heap.
+//
+// the executor must outlive the dispatches it has scheduled.
+class PriorityExecutor : public Executor {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit PriorityExecutor(
+      Executor* executor,
+      Clock::duration aging = std::chrono::milliseconds(10));
+
+  // post with |Priority::kNormal|
+  void Post(std::function<void()>&& f) override;
+  void PostBatch(std::function<void()>* tasks, std::size_t count) override;
+
+  void Post(Priority priority, std::function<void()>&& f);
+
+  void PostWithDeadline(Clock::time_point deadline,
+                        std::function<void()>&& f);
+
+ private:
+  struct Entry {
+    std::function<void()> task;
+    Clock::time_point enqueued;
+  };
+
+  struct Deadline {
+    std::function<void()> task;
+    Clock::time_point enqueued;
+    Clock::time_point deadline;
+
+    bool operator>(const Deadline& other) const {
+      return deadline > other.deadline;
+    }
+  };
+
+  struct Lane {
+    std::mutex consumer;
+    MpscQueue<Entry> entries;
+  };
+
+  static constexpr std::size_t kNumLanes =
+      static_cast<std::size_t>(Priority::kLow) + 1;
+  // the rank of the deadline lane, the priority lanes rank from 0
+  static constexpr std::int64_t kDeadlineRank = -1;
+
+  void Dispatch();
+
+  // the rank of a callback of |rank| which waits since |enqueued|, the lower
+  // the more urgent
+  std::int64_t Age(std::int64_t rank, Clock::time_point enqueued,
+                   Clock::time_point now) const;
+
+  bool TryRunLane(std::size_t lane);
+  bool TryRunDeadline();
+
+ private:
+  Executor* executor_;
+  Clock::duration aging_;
+
+  Lane lanes_[kNumLanes];
+
+  std::mutex deadline_mutex_;
+  std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>>
+      deadlines_;
+  std::atomic<std::size_t> deadline_count_{0};
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(PriorityExecutor);
+};
+
+}  // namespace event
+}  // namespace base
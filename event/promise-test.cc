@@ -3,40 +3,50 @@
 
 #include <catch-include.h>
 
-#include <list>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "executor.h"
+#include "mock-executor.h"
+#include "promise-timer.h"
 
-namespace base {
-namespace event {
+#if !defined(__SANITIZE_ADDRESS__)
+namespace {
 
-struct MockExecutor : public Executor {
-  using Callback = std::function<void()>;
-  std::size_t count{0};
-  std::list<Callback> queue;
+std::atomic<std::size_t> g_allocations{0};
 
-  void Post(Callback&& f) { queue.push_back(std::move(f)); }
+}  // namespace
 
-  void Run() {
-    while (!queue.empty()) {
-      auto cb = std::move(queue.front());
-      queue.pop_front();
-      cb();
-      ++count;
-    }
-  }
+// the replaced operators pair malloc and free on purpose, gcc sees the free
+// of a pointer returned by operator new once they are inlined at -O2
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
 
-  bool RunOne() {
-    if (!queue.empty()) {
-      auto cb = std::move(queue.front());
-      queue.pop_front();
-      cb();
-      ++count;
-      return true;
-    }
-    return false;
+// counts the allocations of the tests, asan has its own operator new
+void* operator new(std::size_t size) {
+  ++g_allocations;
+  if (auto p = std::malloc(size ? size : 1)) {
+    return p;
   }
-};
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+namespace base {
+namespace event {
 
 TEST_CASE("basic", "[promise]") {
   {
@@ -69,9 +79,482 @@ TEST_CASE("basic", "[promise]") {
 
     REQUIRE(value == 2022);
     REQUIRE(p1.IsFulfilled());
+    REQUIRE(p2.IsPreFulfilled());
+
+    bool called = false;
+    p2.Then([&](Result<void>&& r) { called = static_cast<bool>(r); }, &exec);
+    exec.Run();
+
+    REQUIRE(called);
     REQUIRE(p2.IsFulfilled());
   }
 }
 
+TEST_CASE("trampolined chain", "[promise]") {
+  TrampolineExecutor exec;
+
+  std::vector<Promise<int>> chain(1);
+  for (int i = 0; i < 100000; ++i) {
+    chain.push_back(chain.back().Then(
+        [](Result<int>&& r) -> Result<int> { return r.GetResult() + 1; },
+        &exec));
+  }
+
+  int value = 0;
+  chain.back().Then([&](Result<int>&& r) { value = r.GetResult(); }, &exec);
+
+  REQUIRE(chain.front().Resolve(0));
+  REQUIRE(value == 100000);
+}
+
+TEST_CASE("dropped callback", "[promise]") {
+  MockExecutor exec;
+
+  bool called = false;
+  Promise<int> p;
+  p.Then([&](Result<int>&&) { called = true; }, &exec);
+  REQUIRE(p.Resolve(1));
+  REQUIRE(p.IsPreFulfilled());
+
+  // the executor drops the callback unrun, the promise is cancelled
+  exec.queue.clear();
+  REQUIRE(p.IsCancelled());
+  REQUIRE(!called);
+}
+
+namespace {
+
+struct Anchored {
+  int value = 0;
+
+  const WeakAnchor& weak_anchor() const { return anchor; }
+
+  WeakAnchor anchor;
+};
+
+struct Shared : std::enable_shared_from_this<Shared> {
+  int value = 0;
+};
+
+}  // namespace
+
+TEST_CASE("bind weak", "[promise]") {
+  MockExecutor exec;
+
+  auto object = std::make_unique<Anchored>();
+  auto self = object.get();
+  auto bound = BindWeakFunctor(self->weak_anchor(), [self](Result<int>&& r) {
+    self->value = r.GetResult();
+  });
+
+  // stored by the callback of the promise inline
+  static_assert(std::is_trivially_copyable<decltype(bound)>::value);
+  static_assert(sizeof(bound) <= 2 * sizeof(void*));
+
+  Promise<int> p0;
+  p0.Then(bound, &exec);
+  REQUIRE(p0.Resolve(1));
+  exec.Run();
+  REQUIRE(object->value == 1);
+
+  Promise<int> p1;
+  p1.Then(bound, &exec);
+  REQUIRE(bound);
+  object.reset();
+  REQUIRE(!bound);
+  REQUIRE(p1.Resolve(2));
+  exec.Run();
+
+  // the slot is reused by another anchor, the stale handle stays invalid
+  Anchored other;
+  REQUIRE(!bound);
+  REQUIRE(BindWeakFunctor(other.anchor, []() {}));
+
+  Anchored invalidated;
+  auto handle = invalidated.anchor.GetHandle();
+  REQUIRE(handle.IsValid());
+  invalidated.anchor.Invalidate();
+  REQUIRE(!handle.IsValid());
+  REQUIRE(invalidated.anchor.GetHandle().IsValid());
+  REQUIRE(!WeakHandle{}.IsValid());
+
+  // a raw pointer is always bound by weak_from_this
+  auto shared = std::make_shared<Shared>();
+  auto raw = shared.get();
+  Promise<int> p2;
+  p2.Then(BindWeakFunctor(raw,
+                          [raw](Result<int>&& r) {
+                            raw->value = r.GetResult();
+                          }),
+          &exec);
+  REQUIRE(p2.Resolve(3));
+  exec.Run();
+  REQUIRE(shared->value == 3);
+}
+
+#if !defined(__SANITIZE_ADDRESS__)
+TEST_CASE("bind weak, allocations", "[promise]") {
+  MockExecutor exec;
+
+  Anchored object;
+  auto self = &object;
+  auto cycle = [&exec](auto callback) {
+    auto before = g_allocations.load();
+    Promise<int> p;
+    p.Then(std::move(callback), &exec);
+    auto resolved = p.Resolve(1);
+    exec.Run();
+    auto allocations = g_allocations.load() - before;
+    REQUIRE(resolved);
+    return allocations;
+  };
+
+  auto bound = BindWeakFunctor(self->weak_anchor(), [self](Result<int>&& r) {
+    self->value += r.GetResult();
+  });
+  int runs = 0;
+  int step = 1;
+  auto erased = [self, &runs, step](Result<int>&& r) {
+    self->value += r.GetResult();
+    runs += step;
+  };
+  static_assert(sizeof(erased) > 2 * sizeof(void*));
+
+  // warmed up, the bound callback takes no allocation of its own, the one
+  // too large to be stored inline does
+  cycle(bound);
+  cycle(erased);
+  auto bound_allocations = cycle(bound);
+  auto erased_allocations = cycle(erased);
+  REQUIRE(erased_allocations == bound_allocations + 1);
+  // the state is pooled, the posted hop and the node of the mock queue are
+  // allocated
+  REQUIRE(bound_allocations == 2);
+  REQUIRE(object.value == 4);
+  REQUIRE(runs == 2);
+}
+#endif
+
+TEST_CASE("void chain", "[promise]") {
+  MockExecutor exec;
+
+  Promise<void> p0;
+  auto p1 = p0.Then([](Result<void>&& r) -> Result<int> { return 1; }, &exec);
+  auto p2 = p1.Then(
+      [](Result<int>&& r) -> Result<void> {
+        return Err(kErrorEventPromiseAny, "value {}", r.GetResult());
+      },
+      &exec);
+
+  Error error;
+  p2.Then([&](Result<void>&& r) { error = r.PassError(); }, &exec);
+
+  REQUIRE(p0.Resolve());
+  exec.Run();
+
+  REQUIRE(p2.IsRejected());
+  REQUIRE(error.code() == kErrorEventPromiseAny);
+  REQUIRE(error.GetMessage() == "value 1");
+}
+
+TEST_CASE("void join", "[promise]") {
+  MockExecutor exec;
+
+  std::vector<Promise<void>> signals(3);
+
+  Promise<void> p0;
+  auto all = p0.ThenAll([&](Result<void>&&) { return signals; }, &exec);
+
+  bool called = false;
+  all.Then([&](Result<void>&& r) { called = static_cast<bool>(r); }, &exec);
+
+  REQUIRE(p0.Resolve());
+  exec.Run();
+  REQUIRE(all.IsEmpty());
+
+  for (auto& s : signals) {
+    REQUIRE(s.Resolve());
+  }
+  exec.Run();
+
+  REQUIRE(called);
+  REQUIRE(all.IsFulfilled());
+}
+
+TEST_CASE("all settled", "[promise]") {
+  MockExecutor exec;
+
+  std::vector<Promise<int>> promises(3);
+  auto all = MkAllSettledPromise(promises, &exec);
+
+  std::vector<Result<int>> results;
+  all.Then(
+      [&](Result<std::vector<Result<int>>>&& r) { results = r.PassResult(); },
+      &exec);
+
+  REQUIRE(promises[0].Resolve(1));
+  REQUIRE(promises[1].Reject(Err(kErrorEventPromiseAny)));
+  exec.Run();
+  REQUIRE(all.IsEmpty());
+
+  REQUIRE(promises[2].Resolve(3));
+  exec.Run();
+
+  REQUIRE(all.IsFulfilled());
+  REQUIRE(results.size() == 3);
+  REQUIRE(results[0].GetResult() == 1);
+  REQUIRE(!results[1]);
+  REQUIRE(results[2].GetResult() == 3);
+}
+
+TEST_CASE("for each concurrent", "[promise]") {
+  MockExecutor exec;
+
+  std::vector<int> inputs{1, 2, 3, 4, 5};
+  std::vector<Promise<int>> started;
+  std::size_t max_running = 0;
+
+  auto done = ForEachConcurrent(
+      inputs,
+      [&](int v) {
+        Promise<int> p;
+        started.push_back(p);
+
+        std::size_t running = 0;
+        for (auto& s : started) running += s.IsEmpty() ? 1 : 0;
+        max_running = std::max(max_running, running);
+        return p;
+      },
+      2, &exec);
+
+  REQUIRE(started.size() == 2);
+
+  // settle in reverse order, the freed slot is refilled right away
+  REQUIRE(started[1].Resolve(20));
+  exec.Run();
+  REQUIRE(started.size() == 3);
+
+  while (!done.IsSettled()) {
+    for (std::size_t i = 0; i < started.size(); ++i) {
+      if (started[i].IsEmpty()) {
+        started[i].Resolve(inputs[i] * 10);
+      }
+    }
+    exec.Run();
+  }
+
+  REQUIRE(started.size() == 5);
+  REQUIRE(max_running == 2);
+
+  std::vector<Result<int>> results;
+  done.Then(
+      [&](Result<std::vector<Result<int>>>&& r) { results = r.PassResult(); },
+      &exec);
+  exec.Run();
+
+  REQUIRE(results.size() == 5);
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    REQUIRE(results[i].GetResult() == inputs[i] * 10);
+  }
+}
+
+TEST_CASE("for each concurrent, synchronously settled", "[promise]") {
+  std::vector<int> inputs(1000, 1);
+
+  auto done = ForEachConcurrent(
+      inputs, [](int v) { return MkResolvedPromise(v); }, 4, nullptr);
+
+  REQUIRE(done.IsPreFulfilled());
+
+  // a limit of zero is taken as one, instead of never settling
+  std::vector<Promise<int>> pending(3);
+  std::size_t started = 0;
+  auto serial = ForEachConcurrent(
+      pending,
+      [&](Promise<int>& p) {
+        ++started;
+        return p;
+      },
+      0, nullptr);
+  REQUIRE(started == 1);
+  for (auto& p : pending) {
+    REQUIRE(p.Resolve(1));
+  }
+  REQUIRE(started == 3);
+  REQUIRE(serial.IsPreFulfilled());
+}
+
+TEST_CASE("hedged", "[promise]") {
+  MockExecutor exec;
+  TimerWheel wheel;
+
+  std::vector<Promise<int>> attempts;
+  auto p = MkHedgedPromise(
+      [&]() {
+        attempts.emplace_back();
+        return attempts.back();
+      },
+      10, 2, &wheel, &exec);
+
+  REQUIRE(attempts.size() == 1);
+
+  wheel.Advance(9);
+  REQUIRE(attempts.size() == 1);
+  wheel.Advance(1);
+  REQUIRE(attempts.size() == 2);
+
+  // the hedge wins, the first attempt is cancelled
+  REQUIRE(attempts[1].Resolve(7));
+  exec.Run();
+
+  REQUIRE(p.IsSatisfied());
+  REQUIRE(attempts[0].IsCancelled());
+
+  wheel.Advance(100);
+  REQUIRE(attempts.size() == 2);
+  REQUIRE(wheel.IsEmpty());
+}
+
+TEST_CASE("hedged, all attempts failed", "[promise]") {
+  MockExecutor exec;
+  TimerWheel wheel;
+
+  std::size_t count = 0;
+  auto p = MkHedgedPromise(
+      [&]() {
+        ++count;
+        return MkRejectedPromise<int>(Err(kErrorEventPromiseAny));
+      },
+      10, 2, &wheel, &exec);
+
+  exec.Run();
+
+  REQUIRE(count == 3);
+  REQUIRE(p.IsUnsatisfied());
+  REQUIRE(wheel.IsEmpty());
+}
+
+TEST_CASE("retry", "[promise]") {
+  MockExecutor exec;
+  TimerWheel wheel;
+
+  RetryPolicy policy;
+  policy.max_attempts = 4;
+  policy.initial_backoff = 10;
+  policy.retryable.push_back({Cat(), kErrorEventPromiseAny});
+
+  std::vector<std::size_t> attempts;
+  auto p = MkRetryPromise(
+      [&](std::size_t attempt) {
+        attempts.push_back(attempt);
+        if (attempt < 3) {
+          return MkRejectedPromise<int>(Err(kErrorEventPromiseAny));
+        }
+        return MkResolvedPromise(42);
+      },
+      policy, &wheel, &exec);
+
+  exec.Run();
+  REQUIRE(attempts.size() == 1);
+
+  // backoff 10 ticks, then 20 ticks
+  wheel.Advance(10);
+  exec.Run();
+  REQUIRE(attempts.size() == 2);
+
+  wheel.Advance(19);
+  exec.Run();
+  REQUIRE(attempts.size() == 2);
+  wheel.Advance(1);
+  exec.Run();
+
+  REQUIRE(attempts == std::vector<std::size_t>{1, 2, 3});
+  REQUIRE(p.IsSatisfied());
+  REQUIRE(wheel.IsEmpty());
+}
+
+TEST_CASE("retry, not retryable", "[promise]") {
+  MockExecutor exec;
+  TimerWheel wheel;
+
+  RetryPolicy policy;
+  policy.retryable.push_back({Cat(), kErrorEventPromiseAny + 1});
+
+  std::size_t count = 0;
+  auto p = MkRetryPromise(
+      [&](std::size_t) {
+        ++count;
+        return MkRejectedPromise<int>(Err(kErrorEventPromiseAny));
+      },
+      policy, &wheel, &exec);
+
+  exec.Run();
+
+  REQUIRE(count == 1);
+  REQUIRE(p.IsUnsatisfied());
+  REQUIRE(wheel.IsEmpty());
+}
+
+TEST_CASE("retry, wheel aborted while backing off", "[promise]") {
+  MockExecutor exec;
+  TimerWheel wheel;
+
+  RetryPolicy policy;
+  policy.initial_backoff = 10;
+
+  std::size_t count = 0;
+  auto p = MkRetryPromise(
+      [&](std::size_t) {
+        ++count;
+        return MkRejectedPromise<int>(Err(kErrorEventPromiseAny));
+      },
+      policy, &wheel, &exec);
+
+  Error error;
+  p.Then([&](Result<int>&& r) { error = r.PassError(); }, &exec);
+
+  exec.Run();
+  REQUIRE(count == 1);
+  REQUIRE(!wheel.IsEmpty());
+
+  wheel.Abort();
+  exec.Run();
+
+  REQUIRE(count == 1);
+  REQUIRE(p.IsUnsatisfied());
+  REQUIRE(error.code() == kErrorEventTimerAborted);
+  REQUIRE(wheel.IsEmpty());
+}
+
+TEST_CASE("retry backoff", "[promise]") {
+  RetryPolicy policy;
+  policy.initial_backoff = 4;
+  policy.max_backoff = 20;
+
+  REQUIRE(policy.Backoff(1) == 4);
+  REQUIRE(policy.Backoff(2) == 8);
+  REQUIRE(policy.Backoff(3) == 16);
+  REQUIRE(policy.Backoff(4) == 20);
+
+  policy.jitter = 0.5;
+  for (std::size_t i = 0; i < 100; ++i) {
+    auto backoff = policy.Backoff(3);
+    REQUIRE(backoff >= 8);
+    REQUIRE(backoff <= 16);
+  }
+}
+
+TEST_CASE("pooled states", "[promise]") {
+  MockExecutor exec;
+  int value = 0;
+  for (int i = 0; i < 100; ++i) {
+    Promise<int> p;
+    p.Then([&](Result<int>&& r) { value += r.GetResult(); }, &exec);
+    REQUIRE(p.Resolve(1));
+    exec.Run();
+  }
+  REQUIRE(value == 100);
+}
+
 }  // namespace event
 }  // namespace base
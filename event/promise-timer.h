@@ -0,0 +1,261 @@
+#pragma once
+
+#include <common/timer-wheel.h>
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "basic.h"
+#include "executor.h"
+#include "promise.h"
+
+namespace base {
+namespace event {
+
+// hedged request, start one attempt produced by |factory|, and start another
+// one every |hedge_delay| ticks of |wheel| while none of the running attempts
+// has succeeded, up to |max_hedges| extra attempts. an attempt failing early
+// starts the next hedge right away instead of waiting for the timer.
+//
+// the promise is resolved with the first success, like |MkRacePromise|, and
+// the losers are cancelled. it is rejected with the last error once every
+// attempt has failed.
+template <typename F, typename PromiseType = std::invoke_result_t<F>,
+          typename R = typename PromiseType::ValueType>
+Promise<R> MkHedgedPromise(F&& factory, Tick hedge_delay,
+                           std::size_t max_hedges, TimerWheel* wheel,
+                           Executor* executor) {
+  static_assert(IsPromise<PromiseType>::value, "factory must return Promise");
+  DCHECK(hedge_delay > 0);
+
+  struct Context : std::enable_shared_from_this<Context> {
+    std::decay_t<F> factory;
+    Tick hedge_delay;
+    std::size_t max_attempts;
+    TimerWheel* wheel;
+    Executor* executor;
+
+    std::size_t failure_counter{0};
+    std::vector<PromiseType> attempts;
+    std::unique_ptr<TimerEventBase> timer;
+    Promise<R> done;
+
+    Context(F&& f, Tick d, std::size_t m, TimerWheel* w, Executor* e)
+        : factory(std::forward<F>(f)),
+          hedge_delay(d),
+          max_attempts(m + 1),
+          wheel(w),
+          executor(e) {
+      attempts.reserve(max_attempts);
+    }
+
+    bool HasMoreAttempts() const { return attempts.size() < max_attempts; }
+
+    void Start() {
+      std::size_t idx = attempts.size();
+      attempts.push_back(std::invoke(factory));
+      attempts.back().Then(
+          [self = this->shared_from_this(), idx](base::Result<R>&& r) mutable {
+            self->OnSettled(idx, std::move(r));
+          },
+          executor);
+
+      if (done.IsEmpty() && HasMoreAttempts()) {
+        Arm();
+      }
+    }
+
+    // the timer only holds a weak reference, the running attempts own us
+    void Arm() {
+      if (!timer) {
+        auto hedge = [weak = this->weak_from_this()]() {
+          if (auto self = weak.lock(); self) {
+            self->OnHedge();
+          }
+        };
+        timer = std::make_unique<TimerEvent<decltype(hedge)>>(std::move(hedge));
+      }
+      wheel->Schedule(timer.get(), hedge_delay);
+    }
+
+    void OnHedge() {
+      if (done.IsEmpty() && HasMoreAttempts()) {
+        Start();
+      }
+    }
+
+    void OnSettled(std::size_t idx, base::Result<R>&& r) {
+      if (!done.IsEmpty()) return;
+
+      if (r) {
+        done.Resolve(r.PassResult());
+        Finish(idx);
+        return;
+      }
+
+      ++failure_counter;
+      if (HasMoreAttempts()) {
+        Start();
+      } else if (failure_counter == attempts.size()) {
+        done.Reject(r.PassError());
+        Finish(idx);
+      }
+    }
+
+    void Finish(std::size_t winner) {
+      if (timer) {
+        timer->Cancel();
+      }
+      for (std::size_t i = 0; i < attempts.size(); ++i) {
+        if (i != winner) {
+          attempts[i].Cancel();
+        }
+      }
+    }
+  };
+
+  auto context = std::make_shared<Context>(std::forward<F>(factory),
+                                           hedge_delay, max_hedges, wheel,
+                                           executor);
+  auto done = context->done;
+  context->Start();
+  return done;
+}
+
+// |RetryPolicy| describes how |MkRetryPromise| retries a failed attempt. the
+// backoff before attempt n + 1 is |initial_backoff| * |multiplier| ^ (n - 1),
+// capped by |max_backoff|, of which up to a |jitter| fraction is randomly
+// taken off to spread retries of concurrent callers.
+struct RetryPolicy {
+  struct Retryable {
+    const Error::Category* category;
+    // any code of the category is retryable if not set
+    std::optional<std::uint32_t> code;
+  };
+
+  std::size_t max_attempts{3};
+  Tick initial_backoff{1};
+  Tick max_backoff{std::numeric_limits<Tick>::max()};
+  double multiplier{2.0};
+  double jitter{0.0};
+
+  // errors worth retrying, an empty list retries every error
+  std::vector<Retryable> retryable;
+
+  bool IsRetryable(const Error& e) const {
+    if (retryable.empty()) return true;
+    return std::any_of(retryable.begin(), retryable.end(),
+                       [&](const Retryable& r) {
+                         return r.category == e.category() &&
+                                (!r.code || *r.code == e.code());
+                       });
+  }
+
+  // the backoff after |attempt| (1-based) has failed
+  Tick Backoff(std::size_t attempt) const {
+    double backoff = static_cast<double>(initial_backoff);
+    for (std::size_t i = 1; i < attempt && backoff < max_backoff; ++i) {
+      backoff *= multiplier;
+    }
+    backoff = std::min(backoff, static_cast<double>(max_backoff));
+
+    if (jitter > 0) {
+      thread_local std::minstd_rand engine{std::random_device{}()};
+      std::uniform_real_distribution<double> dist(0, jitter);
+      backoff -= backoff * dist(engine);
+    }
+    return std::max<Tick>(1, static_cast<Tick>(backoff));
+  }
+};
+
+// retry the attempts produced by |factory| until one succeeds, an error is
+// not retryable by |policy|, or |policy.max_attempts| is reached. |factory| is
+// invoked with the 1-based attempt number. the backoff between attempts is
+// scheduled on |wheel|, so a waiting retry never occupies a thread.
+//
+// the promise is settled with the result of the last attempt. cancelling the
+// |wheel| while backing off rejects it with the cancellation error, and
+// aborting the |wheel| rejects it with |kErrorEventTimerAborted|.
+template <typename F,
+          typename PromiseType = std::invoke_result_t<F, std::size_t>,
+          typename R = typename PromiseType::ValueType>
+Promise<R> MkRetryPromise(F&& factory, RetryPolicy policy, TimerWheel* wheel,
+                          Executor* executor) {
+  static_assert(IsPromise<PromiseType>::value, "factory must return Promise");
+  DCHECK(policy.max_attempts > 0);
+
+  // a single context is shared by every attempt, and its timer is
+  // rescheduled for each backoff.
+  struct Context : TimerEventBase, std::enable_shared_from_this<Context> {
+    std::decay_t<F> factory;
+    RetryPolicy policy;
+    TimerWheel* wheel;
+    Executor* executor;
+
+    std::size_t attempts{0};
+    std::optional<PromiseType> current;
+    Promise<R> done;
+
+    // keep alive while backing off, nothing else refers to us then
+    std::shared_ptr<Context> self;
+
+    Context(F&& f, RetryPolicy&& p, TimerWheel* w, Executor* e)
+        : factory(std::forward<F>(f)),
+          policy(std::move(p)),
+          wheel(w),
+          executor(e) {}
+
+    void Start() {
+      ++attempts;
+      current.emplace(std::invoke(factory, attempts));
+      current->Then(
+          [self = this->shared_from_this()](base::Result<R>&& r) mutable {
+            self->OnSettled(std::move(r));
+          },
+          executor);
+    }
+
+    void OnSettled(base::Result<R>&& r) {
+      if (r) {
+        done.Resolve(r.PassResult());
+        return;
+      }
+
+      if (attempts >= policy.max_attempts ||
+          !policy.IsRetryable(r.GetError())) {
+        done.Reject(r.PassError());
+        return;
+      }
+
+      self = this->shared_from_this();
+      wheel->Schedule(this, policy.Backoff(attempts));
+    }
+
+    void Execute() override {
+      auto holder = Pass(&self);
+      Start();
+    }
+
+    void OnCancel(Error&& e) override {
+      auto holder = Pass(&self);
+      done.Reject(std::move(e));
+    }
+
+    void OnAbort() override {
+      auto holder = Pass(&self);
+      done.Reject(Err(kErrorEventTimerAborted));
+    }
+  };
+
+  auto context = std::make_shared<Context>(std::forward<F>(factory),
+                                           std::move(policy), wheel, executor);
+  auto done = context->done;
+  context->Start();
+  return done;
+}
+
+}  // namespace event
+}  // namespace base
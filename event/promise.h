@@ -3,12 +3,15 @@
 #include <common/bind.h>
 #include <common/common.h>
 #include <common/error.h>
+#include <common/object-pool.h>
 #include <common/result.h>
 #include <common/trait.h>
 
+#include <atomic>
 #include <functional>
 #include <memory>
-#include <iostream>
+#include <optional>
+#include <vector>
 
 #include "basic.h"
 #include "executor.h"
@@ -41,11 +44,15 @@ enum class PromiseStatus : std::uint8_t {
   kCancelled,
 };
 
+// the status is atomic, so that a promise waiting for a callback dropped by
+// its executor can be cancelled by the dropping thread, see |PostedCallback|.
 class PromiseStatusMachine {
  public:
   PromiseStatusMachine() = default;
 
-  PromiseStatus status() const { return status_; }
+  PromiseStatus status() const {
+    return status_.load(std::memory_order_acquire);
+  }
 
   bool IsEmpty() const { return status() == PromiseStatus::kInit; }
   bool IsPreFulfilled() const {
@@ -70,18 +77,15 @@ class PromiseStatusMachine {
     return To(PromiseStatus::kPreRejected, PromiseStatus::kRejected);
   }
   bool ToCancelled() {
-    switch (status()) {
-      case PromiseStatus::kInit:
-      case PromiseStatus::kPreRejected:
-      case PromiseStatus::kPreFulfilled:
-        status_ = PromiseStatus::kCancelled;
-        return true;
-      default:
-        return false;
-    }
+    return To(PromiseStatus::kInit, PromiseStatus::kCancelled) ||
+           ToCancelledFromPending();
+  }
+  bool ToCancelledFromPending() {
+    return To(PromiseStatus::kPreFulfilled, PromiseStatus::kCancelled) ||
+           To(PromiseStatus::kPreRejected, PromiseStatus::kCancelled);
   }
 
-  void Force(PromiseStatus s) { status_ = s; }
+  void Force(PromiseStatus s) { status_.store(s, std::memory_order_release); }
 
  public:
   // the callback has not been invoked
@@ -101,14 +105,58 @@ class PromiseStatusMachine {
 
  private:
   bool To(PromiseStatus from, PromiseStatus to) {
-    if (status() == from) {
-      status_ = to;
-      return true;
+    return status_.compare_exchange_strong(from, to,
+                                           std::memory_order_acq_rel);
+  }
+
+  std::atomic<PromiseStatus> status_{PromiseStatus::kInit};
+};
+
+// |PostedCallback| is posted to run the callback of a promise state. an
+// executor dropping it unrun, e.g. when shutting down, cancels the state
+// instead of leaving it pending, which releases the callback and its
+// captures.
+//
+// the dropping thread may not be the one of the promise. while the state is
+// pending, its callback and result belong to the posted callback, so they
+// are released by the thread winning the atomic transition to cancelled.
+// only the callback constructed by the state, or the one it's moved into,
+// cancels it, the executors are expected to move the callbacks.
+template <typename State>
+class PostedCallback {
+ public:
+  explicit PostedCallback(State* state)
+      : state_(state->weak_from_this()), armed_(true) {}
+
+  PostedCallback(PostedCallback&& other) noexcept
+      : state_(std::move(other.state_)), armed_(other.armed_) {
+    other.armed_ = false;
+  }
+  // |std::function| has to be copyable, but only one of the copies could
+  // cancel the state, so an armed callback is never copied
+  PostedCallback(const PostedCallback& other) : state_(other.state_) {
+    DCHECK(!other.armed_);
+  }
+
+  ~PostedCallback() {
+    if (!armed_) {
+      return;
+    }
+    if (auto state = state_.lock()) {
+      state->CancelDropped();
     }
-    return false;
   }
 
-  PromiseStatus status_{PromiseStatus::kInit};
+  void operator()() {
+    armed_ = false;
+    if (auto state = state_.lock()) {
+      state->RunPosted();
+    }
+  }
+
+ private:
+  std::weak_ptr<State> state_;
+  bool armed_{false};
 };
 
 template <typename T>
@@ -145,10 +193,9 @@ class PromiseState : public std::enable_shared_from_this<PromiseState<T>> {
   }
 
   void Cancel() {
-    if (IsEmpty() || IsPending()) {
+    if (status_.ToCancelled()) {
       callback_ = {};
       storage_ = std::nullopt;
-      status_.ToCancelled();
     }
   }
 
@@ -179,30 +226,40 @@ class PromiseState : public std::enable_shared_from_this<PromiseState<T>> {
             std::enable_if_t<base::IsResult<RT>::value, int> = 0>
   void Attach(Promise<U>& next, F&& callback, Executor* exectuor);
 
+  // function<Promise<RT>(base::Result<T>&&)>
+  template <typename U, typename F, typename RT = std::invoke_result_t<F, T>,
+            std::enable_if_t<IsPromise<RT>::value, int> = 0>
+  void Attach(Promise<U>& next, F&& callback, Executor* exectuor);
+
  private:
   void TryInvokeCallback() {
     if (callback_ && IsPending()) {
-      auto cb = [this]() -> void {
-        switch (status()) {
-          case PromiseStatus::kPreFulfilled:
-            std::cout << "prefulfilled" << std::endl;
-            CHECK(status_.ToFulfilled());
-            InvokeCallback();
-            break;
-
-          case PromiseStatus::kPreRejected:
-            std::cout << "rejected" << std::endl;
-            CHECK(status_.ToRejected());
-            InvokeCallback();
-            break;
-
-          default:
-            std::cout << "default" << std::endl;
-            break;
-        }
-      };
-
-      RunInExecutor(BindWeak(this, std::move(cb)));
+      RunInExecutor(PostedCallback<PromiseState>(this));
+    }
+  }
+
+  // called by the thread dropping the posted callback
+  void CancelDropped() {
+    if (status_.ToCancelledFromPending()) {
+      callback_ = {};
+      storage_ = std::nullopt;
+    }
+  }
+
+  void RunPosted() {
+    switch (status()) {
+      case PromiseStatus::kPreFulfilled:
+        CHECK(status_.ToFulfilled());
+        InvokeCallback();
+        break;
+
+      case PromiseStatus::kPreRejected:
+        CHECK(status_.ToRejected());
+        InvokeCallback();
+        break;
+
+      default:
+        break;
     }
   }
 
@@ -237,6 +294,7 @@ class PromiseState : public std::enable_shared_from_this<PromiseState<T>> {
 
   template <typename U>
   friend class Promise;
+  friend class PostedCallback<PromiseState>;
 
   DISALLOW_COPY_AND_ASSIGN(PromiseState);
 };
@@ -272,21 +330,47 @@ void PromiseState<T>::Attach(Promise<U>& next, F&& callback,
   AddCallback(std::move(cb), executor);
 }
 
+// eg.
+// Promise<int> p0;
+// auto p1 = p0.Then([&](Result<int>&& r) -> Promise<bool> {
+//    return MkResolvedPromise(false);
+// }, &exectuor);
+template <typename T>
+template <typename U, typename F, typename RT,
+          std::enable_if_t<IsPromise<RT>::value, int>>
+void PromiseState<T>::Attach(Promise<U>& next, F&& callback,
+                             Executor* executor) {
+  auto cb = [n = next, f = std::forward<F>(callback),
+             executor](base::Result<T>&& r) mutable {
+    auto inner = std::invoke(std::forward<decltype(f)>(f), std::move(r));
+    inner.Then(
+        [n, inner](base::Result<U>&& r) mutable { n.Propagate(&r); },
+        executor);
+  };
+
+  AddCallback(std::move(cb), executor);
+}
+
+// the result of a void promise is either nothing or an error, so there is no
+// need for a |std::optional<base::Result<void>>|. the error slot is the only
+// storage, and it is empty once resolved.
 template <>
-class PromiseState<void> {
+class PromiseState<void>
+    : public std::enable_shared_from_this<PromiseState<void>> {
  public:
-  PromiseState() : status_(), storage_() {}
+  using ValueType = void;
+  using Callback = std::function<void(base::Result<void>&&)>;
+
+  PromiseState() : status_(), error_(), callback_(), executor_(nullptr) {}
 
   PromiseState(PromiseState&&) = default;
   PromiseState& operator=(PromiseState&&) = default;
 
-  // Since this specialization doesn't need invoke callback in given executor,
-  // it's not necessary to transfer state to |kPreFulfilled| and |kPreRejected|.
-  // we should force state transition when call |Resolve| and |Reject|.
+ public:
   bool Resolve() {
     if (IsEmpty()) {
-      storage_.emplace(base::Result<void>{});
-      status_.Force(PromiseStatus::kFulfilled);
+      status_.ToPreFulfilled();
+      TryInvokeCallback();
       return true;
     }
     return false;
@@ -294,17 +378,18 @@ class PromiseState<void> {
 
   bool Reject(base::Error&& e) {
     if (IsEmpty()) {
-      storage_.emplace(base::Result<void>{std::move(e)});
-      status_.Force(PromiseStatus::kRejected);
+      error_ = std::move(e);
+      status_.ToPreRejected();
+      TryInvokeCallback();
       return true;
     }
     return false;
   }
 
   void Cancel() {
-    if (IsEmpty() || IsPending()) {
-      storage_ = std::nullopt;
-      status_.ToCancelled();
+    if (status_.ToCancelled()) {
+      callback_ = {};
+      error_.Clear();
     }
   }
 
@@ -324,16 +409,126 @@ class PromiseState<void> {
   bool IsRejected() const { return status_.IsRejected(); }
   bool IsCancelled() const { return status_.IsCancelled(); }
 
+ public:
+  // function<void(base::Result<void>&&)>
+  template <typename F,
+            typename RT = std::invoke_result_t<F, base::Result<void>>,
+            std::enable_if_t<std::is_void<RT>::value, int> = 0>
+  void Attach(F&& callback, Executor* executor) {
+    AddCallback(std::move(callback), executor);
+  }
+
+  // function<Result<RT>(base::Result<void>&&)>
+  template <typename U, typename F,
+            typename RT = std::invoke_result_t<F, base::Result<void>>,
+            std::enable_if_t<base::IsResult<RT>::value, int> = 0>
+  void Attach(Promise<U>& next, F&& callback, Executor* executor);
+
+  // function<Promise<RT>(base::Result<void>&&)>
+  template <typename U, typename F,
+            typename RT = std::invoke_result_t<F, base::Result<void>>,
+            std::enable_if_t<IsPromise<RT>::value, int> = 0>
+  void Attach(Promise<U>& next, F&& callback, Executor* executor);
+
+ private:
+  void TryInvokeCallback() {
+    if (callback_ && IsPending()) {
+      RunInExecutor(PostedCallback<PromiseState>(this));
+    }
+  }
+
+  // called by the thread dropping the posted callback
+  void CancelDropped() {
+    if (status_.ToCancelledFromPending()) {
+      callback_ = {};
+      error_.Clear();
+    }
+  }
+
+  void RunPosted() {
+    switch (status()) {
+      case PromiseStatus::kPreFulfilled:
+        CHECK(status_.ToFulfilled());
+        InvokeCallback();
+        break;
+
+      case PromiseStatus::kPreRejected:
+        CHECK(status_.ToRejected());
+        InvokeCallback();
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  void InvokeCallback() {
+    auto tmp = base::Pass(&callback_);
+    if (IsFulfilled()) {
+      NO_EXCEPT(tmp(base::Result<void>{}));
+    } else {
+      NO_EXCEPT(tmp(base::Result<void>{std::move(error_)}));
+    }
+  }
+
+  template <typename F>
+  void RunInExecutor(F&& callback) {
+    if (executor_) {
+      executor_->Post(std::move(callback));
+    } else {
+      NO_EXCEPT(callback());
+    }
+  }
+
+  void AddCallback(Callback&& cb, Executor* executor) {
+    callback_ = std::move(cb);
+    executor_ = executor;
+
+    TryInvokeCallback();
+  }
+
  private:
   PromiseStatusMachine status_;
-  std::optional<base::Result<void>> storage_;
+  base::Error error_;
+
+  Callback callback_;
+  Executor* executor_;
 
   template <typename U>
   friend class Promise;
+  friend class PostedCallback<PromiseState>;
 
   DISALLOW_COPY_AND_ASSIGN(PromiseState);
 };
 
+template <typename U, typename F, typename RT,
+          std::enable_if_t<base::IsResult<RT>::value, int>>
+void PromiseState<void>::Attach(Promise<U>& next, F&& callback,
+                                Executor* executor) {
+  auto cb = [n = next,
+             f = std::forward<F>(callback)](base::Result<void>&& r) mutable {
+    auto result = std::invoke(std::forward<decltype(f)>(f), std::move(r));
+    n.Propagate(&result);
+  };
+
+  AddCallback(std::move(cb), executor);
+}
+
+template <typename U, typename F, typename RT,
+          std::enable_if_t<IsPromise<RT>::value, int>>
+void PromiseState<void>::Attach(Promise<U>& next, F&& callback,
+                                Executor* executor) {
+  auto cb = [n = next, f = std::forward<F>(callback),
+             executor](base::Result<void>&& r) mutable {
+    auto inner = std::invoke(std::forward<decltype(f)>(f), std::move(r));
+    inner.Then(
+        [n, inner](base::Result<U>&& r) mutable { n.Propagate(&r); },
+        executor);
+  };
+
+  AddCallback(std::move(cb), executor);
+}
+
 }  // namespace _
 
 template <typename T>
@@ -482,55 +677,55 @@ class PromiseResolver<void> {
   friend class Promise;
 };
 
-bool PromiseResolver<void>::Resolve() {
+inline bool PromiseResolver<void>::Resolve() {
   if (auto p = ptr_.lock(); p) {
     return p->Resolve();
   }
   return false;
 }
 
-bool PromiseResolver<void>::Reject(base::Error&& e) {
+inline bool PromiseResolver<void>::Reject(base::Error&& e) {
   if (auto p = ptr_.lock(); p) {
     return p->Reject(std::move(e));
   }
   return false;
 }
 
-void PromiseResolver<void>::Cancel() {
+inline void PromiseResolver<void>::Cancel() {
   if (auto p = ptr_.lock(); p) {
     p->Cancel();
   }
 }
 
-std::optional<bool> PromiseResolver<void>::IsDone() const {
+inline std::optional<bool> PromiseResolver<void>::IsDone() const {
   if (auto p = ptr_.lock(); p) {
     return p->IsDone();
   }
   return {};
 }
 
-std::optional<bool> PromiseResolver<void>::IsEmpty() const {
+inline std::optional<bool> PromiseResolver<void>::IsEmpty() const {
   if (auto p = ptr_.lock(); p) {
     return p->IsEmpty();
   }
   return {};
 }
 
-std::optional<bool> PromiseResolver<void>::IsSettled() const {
+inline std::optional<bool> PromiseResolver<void>::IsSettled() const {
   if (auto p = ptr_.lock(); p) {
     return p->IsSettled();
   }
   return {};
 }
 
-std::optional<bool> PromiseResolver<void>::IsSatisfied() const {
+inline std::optional<bool> PromiseResolver<void>::IsSatisfied() const {
   if (auto p = ptr_.lock(); p) {
     return p->IsSatisfied();
   }
   return {};
 }
 
-std::optional<bool> PromiseResolver<void>::IsUnsatisfied() const {
+inline std::optional<bool> PromiseResolver<void>::IsUnsatisfied() const {
   if (auto p = ptr_.lock(); p) {
     return p->IsUnsatisfied();
   }
@@ -543,7 +738,9 @@ class Promise {
   using ValueType = T;
   using ResolverType = PromiseResolver<T>;
 
-  Promise() : state_(std::make_shared<_::PromiseState<T>>()) {}
+  Promise()
+      : state_(std::allocate_shared<_::PromiseState<T>>(
+            PoolAllocator<_::PromiseState<T>>())) {}
 
   Promise(Promise&&) = default;
   Promise(const Promise&) = default;
@@ -582,6 +779,11 @@ class Promise {
                                           Promise<typename RT::ValueType>>>
   R Then(F&&, Executor*);
 
+  // the functor return a Promise, the returned promise is settled with it
+  template <typename F, typename RT = std::invoke_result_t<F, T>,
+            std::enable_if_t<IsPromise<RT>::value, int> _ = 0>
+  RT Then(F&&, Executor*);
+
   // the functor return a void
   template <typename F, typename RT = std::invoke_result_t<F, T>,
             std::enable_if_t<std::is_void_v<RT>, int> _ = 0>
@@ -654,6 +856,14 @@ R Promise<T>::Then(F&& functor, Executor* executor) {
   return next;
 }
 
+template <typename T>
+template <typename F, typename RT, std::enable_if_t<IsPromise<RT>::value, int>>
+RT Promise<T>::Then(F&& functor, Executor* executor) {
+  RT next;
+  DoThen(next, std::move(functor), executor);
+  return next;
+}
+
 template <typename T>
 template <typename F, typename RT, std::enable_if_t<std::is_void_v<RT>, int>>
 void Promise<T>::Then(F&& functor, Executor* executor) {
@@ -663,9 +873,12 @@ void Promise<T>::Then(F&& functor, Executor* executor) {
 template <>
 class Promise<void> {
  public:
+  using ValueType = void;
   using ResolverType = PromiseResolver<void>;
 
-  Promise() : state_(std::make_shared<_::PromiseState<void>>()) {}
+  Promise()
+      : state_(std::allocate_shared<_::PromiseState<void>>(
+            PoolAllocator<_::PromiseState<void>>())) {}
 
   Promise(Promise&&) = default;
   Promise(const Promise&) = default;
@@ -692,6 +905,68 @@ class Promise<void> {
   bool IsRejected() const { return state_->IsRejected(); }
   bool IsCancelled() const { return state_->IsCancelled(); }
 
+ public:
+  // the functor return a Result
+  template <typename F,
+            typename RT = std::invoke_result_t<F, base::Result<void>>,
+            typename R = std::enable_if_t<base::IsResult<RT>::value,
+                                          Promise<typename RT::ValueType>>>
+  R Then(F&& functor, Executor* executor) {
+    Promise<typename RT::ValueType> next;
+    state_->Attach(next, std::move(functor), executor);
+    return next;
+  }
+
+  // the functor return a Promise, the returned promise is settled with it
+  template <typename F,
+            typename RT = std::invoke_result_t<F, base::Result<void>>,
+            std::enable_if_t<IsPromise<RT>::value, int> _ = 0>
+  RT Then(F&& functor, Executor* executor) {
+    RT next;
+    state_->Attach(next, std::move(functor), executor);
+    return next;
+  }
+
+  // the functor return a void
+  template <typename F,
+            typename RT = std::invoke_result_t<F, base::Result<void>>,
+            std::enable_if_t<std::is_void_v<RT>, int> _ = 0>
+  void Then(F&& functor, Executor* executor) {
+    state_->Attach(std::move(functor), executor);
+  }
+
+ public:
+  // the functor return a promise container
+  template <typename F>
+  auto ThenAll(F&& f, Executor* executor) {
+    return Then(
+        [f = std::forward<F>(f), executor](base::Result<void>&& r) mutable {
+          auto result = std::invoke(std::forward<decltype(f)>(f), std::move(r));
+          return MkAllPromise(std::move(result), executor);
+        },
+        executor);
+  }
+
+  template <typename F>
+  auto ThenAny(F&& f, Executor* executor) {
+    return Then(
+        [f = std::forward<F>(f), executor](base::Result<void>&& r) mutable {
+          auto result = std::invoke(std::forward<decltype(f)>(f), std::move(r));
+          return MkAnyPromise(std::move(result), executor);
+        },
+        executor);
+  }
+
+  template <typename F>
+  auto ThenRace(F&& f, Executor* executor) {
+    return Then(
+        [f = std::forward<F>(f), executor](base::Result<void>&& r) mutable {
+          auto result = std::invoke(std::forward<decltype(f)>(f), std::move(r));
+          return MkRacePromise(std::move(result), executor);
+        },
+        executor);
+  }
+
  private:
   void Propagate(void* r) {
     base::Result<void>* result = reinterpret_cast<base::Result<void>*>(r);
@@ -715,6 +990,12 @@ Promise<U> MkResolvedPromise(T&& val) {
   return p;
 }
 
+inline Promise<void> MkResolvedPromise() {
+  Promise<void> p;
+  p.Resolve();
+  return p;
+}
+
 template <typename T>
 Promise<T> MkRejectedPromise(base::Error&& e) {
   Promise<T> p;
@@ -726,7 +1007,10 @@ template <typename T, typename F>
 Promise<T> MkPromise(F&& f) {
   Promise<T> p;
 
-  auto resolver = [p](T&& v) mutable { return p.Resolve(std::forward<T>(v)); };
+  // |T| maybe void, whose resolver takes no argument
+  auto resolver = [p](auto&&... v) mutable {
+    return p.Resolve(std::forward<decltype(v)>(v)...);
+  };
 
   auto rejector = [p](base::Error&& e) mutable {
     return p.Reject(std::move(e));
@@ -737,13 +1021,41 @@ Promise<T> MkPromise(F&& f) {
   return p;
 }
 
+namespace _ {
+
+// value type of the promise joined by |MkAllPromise|
+template <typename T>
+struct AllPromiseValue {
+  using Type = std::vector<T>;
+};
+
+template <>
+struct AllPromiseValue<void> {
+  using Type = void;
+};
+
+template <typename F, typename T>
+void ResolveWith(F& resolver, base::Result<T>&& r) {
+  if constexpr (std::is_void_v<T>) {
+    resolver();
+  } else {
+    resolver(r.PassResult());
+  }
+}
+
+}  // namespace _
+
 template <typename Itr,
           typename TraitType = typename std::iterator_traits<Itr>::value_type,
-          typename ValueType = typename TraitType::value_type,
-          typename R = std::vector<ValueType>>
+          typename ValueType = typename TraitType::ValueType,
+          typename R = typename _::AllPromiseValue<ValueType>::Type>
 Promise<R> MkAllPromise(Itr begin, Itr end, Executor* executor) {
   if (begin == end) {
-    return MkResolvedPromise(R{});
+    if constexpr (std::is_void_v<R>) {
+      return MkResolvedPromise();
+    } else {
+      return MkResolvedPromise(R{});
+    }
   }
 
   struct Context {
@@ -754,7 +1066,8 @@ Promise<R> MkAllPromise(Itr begin, Itr end, Executor* executor) {
 
   return MkPromise<R>([begin, end, executor](auto&& resolver, auto&& rejector) {
     std::size_t idx = 0;
-    auto context = std::make_shared<Context>(std::distance(begin, end));
+    auto context = std::allocate_shared<Context>(PoolAllocator<Context>(),
+                                                 std::distance(begin, end));
     for (auto itr = begin; itr != end; ++itr, ++idx) {
       itr->Then(
           [context, resolver, rejector,
@@ -768,7 +1081,16 @@ Promise<R> MkAllPromise(Itr begin, Itr end, Executor* executor) {
 
             context->success_counter--;
             if (context->success_counter == 0) {
-              resolver(std::move(context->results));
+              if constexpr (std::is_void_v<R>) {
+                resolver();
+              } else {
+                R values;
+                values.reserve(context->results.size());
+                for (auto& result : context->results) {
+                  values.push_back(result.PassResult());
+                }
+                resolver(std::move(values));
+              }
             }
           },
           executor);
@@ -781,13 +1103,155 @@ auto MkAllPromise(Cntr&& container, Executor* executor) {
   return MkAllPromise(std::begin(container), std::end(container), executor);
 }
 
+// unlike |MkAllPromise|, the returned promise never rejects. it is resolved
+// once every promise has settled, with the results in input order.
+template <typename Itr,
+          typename TraitType = typename std::iterator_traits<Itr>::value_type,
+          typename ValueType = typename TraitType::ValueType,
+          typename R = std::vector<base::Result<ValueType>>>
+Promise<R> MkAllSettledPromise(Itr begin, Itr end, Executor* executor) {
+  if (begin == end) {
+    return MkResolvedPromise(R{});
+  }
+
+  struct Context {
+    std::size_t settled_counter;
+    R results;
+    Context(std::size_t c) : settled_counter(c), results(c) {}
+  };
+
+  return MkPromise<R>([begin, end, executor](auto&& resolver, auto&&) {
+    std::size_t idx = 0;
+    auto context = std::allocate_shared<Context>(PoolAllocator<Context>(),
+                                                 std::distance(begin, end));
+    for (auto itr = begin; itr != end; ++itr, ++idx) {
+      itr->Then(
+          [context, resolver, idx](base::Result<ValueType>&& r) mutable {
+            context->results[idx] = std::move(r);
+
+            context->settled_counter--;
+            if (context->settled_counter == 0) {
+              resolver(std::move(context->results));
+            }
+          },
+          executor);
+    }
+  });
+}
+
+template <typename Cntr>
+auto MkAllSettledPromise(Cntr&& container, Executor* executor) {
+  return MkAllSettledPromise(std::begin(container), std::end(container),
+                             executor);
+}
+
+// invoke |f| on every element of [begin, end), where |f| returns a promise,
+// keeping at most |max_in_flight| of them unsettled at any time. the next
+// element is started as soon as one settles. the returned promise is resolved
+// with all results in input order, as |MkAllSettledPromise| does. a
+// |max_in_flight| of zero is taken as one.
+//
+// the range is walked lazily, so it must outlive the returned promise.
+template <typename Itr, typename F,
+          typename PromiseType = std::invoke_result_t<
+              F, typename std::iterator_traits<Itr>::reference>,
+          typename ValueType = typename PromiseType::ValueType,
+          typename R = std::vector<base::Result<ValueType>>>
+Promise<R> ForEachConcurrent(Itr begin, Itr end, F&& f,
+                             std::size_t max_in_flight, Executor* executor) {
+  static_assert(IsPromise<PromiseType>::value, "functor must return Promise");
+  if (max_in_flight == 0) {
+    max_in_flight = 1;
+  }
+
+  if (begin == end) {
+    return MkResolvedPromise(R{});
+  }
+
+  struct Context : std::enable_shared_from_this<Context> {
+    Itr current;
+    Itr end;
+    std::decay_t<F> f;
+    std::size_t max_in_flight;
+    Executor* executor;
+
+    std::size_t started{0};
+    std::size_t in_flight{0};
+    std::size_t settled_counter;
+    bool launching{false};
+
+    // keep the running promises alive until they settle
+    std::vector<std::optional<PromiseType>> running;
+    R results;
+    Promise<R> done;
+
+    Context(Itr b, Itr e, F&& functor, std::size_t m, Executor* exec)
+        : current(b),
+          end(e),
+          f(std::forward<F>(functor)),
+          max_in_flight(m),
+          executor(exec),
+          settled_counter(std::distance(b, e)),
+          running(settled_counter),
+          results(settled_counter) {}
+
+    // synchronously settled promises re-enter here, the |launching| flag
+    // turns that recursion into iterations of the outer loop
+    void Launch() {
+      if (launching) return;
+      launching = true;
+      while (in_flight < max_in_flight && current != end) {
+        std::size_t idx = started++;
+        ++in_flight;
+
+        auto& p = running[idx].emplace(std::invoke(f, *current++));
+        p.Then(
+            [self = this->shared_from_this(),
+             idx](base::Result<ValueType>&& r) mutable {
+              self->OnSettled(idx, std::move(r));
+            },
+            executor);
+      }
+      launching = false;
+    }
+
+    void OnSettled(std::size_t idx, base::Result<ValueType>&& r) {
+      results[idx] = std::move(r);
+      running[idx].reset();
+      --in_flight;
+
+      settled_counter--;
+      if (settled_counter == 0) {
+        done.Resolve(std::move(results));
+        return;
+      }
+      Launch();
+    }
+  };
+
+  auto context = std::allocate_shared<Context>(
+      PoolAllocator<Context>(), begin, end, std::forward<F>(f), max_in_flight,
+      executor);
+  auto done = context->done;
+  context->Launch();
+  return done;
+}
+
+template <typename Cntr, typename F>
+auto ForEachConcurrent(Cntr&& range, F&& f, std::size_t max_in_flight,
+                       Executor* executor) {
+  return ForEachConcurrent(std::begin(range), std::end(range),
+                           std::forward<F>(f), max_in_flight, executor);
+}
+
 template <typename Itr,
           typename TraitType = typename std::iterator_traits<Itr>::value_type,
-          typename ValueType = typename TraitType::value_type,
+          typename ValueType = typename TraitType::ValueType,
           typename R = ValueType>
 Promise<R> MkAnyPromise(Itr begin, Itr end, Executor* executor) {
   if (begin == end) {
-    return MkRejectedPromise<R>(Err(kErrorEventPromiseAny, "no promise"));
+    return MkRejectedPromise<R>(
+        Err(kErrorEventPromiseAny, Error::StaticMessage{"no promise"}));
   }
 
   struct Context {
@@ -798,20 +1262,22 @@ Promise<R> MkAnyPromise(Itr begin, Itr end, Executor* executor) {
 
   return MkPromise<R>([begin, end, executor](auto&& resolver, auto&& rejector) {
     std::size_t idx = 0;
-    auto context = std::make_shared<Context>(std::distance(begin, end));
+    auto context = std::allocate_shared<Context>(PoolAllocator<Context>(),
+                                                 std::distance(begin, end));
     for (auto itr = begin; itr != end; ++itr, ++idx) {
       itr->Then(
           [context, resolver, rejector,
            idx](base::Result<ValueType>&& r) mutable {
             if (r) {
-              resolver(r.PassResult());
+              _::ResolveWith(resolver, std::move(r));
               return;
             }
 
             context->errors[idx] = r.PassError();
             context->failure_counter--;
             if (context->failure_counter == 0) {
-              rejector(Err(kErrorEventPromiseAny, "no resolved promise"));
+              rejector(Err(kErrorEventPromiseAny,
+                           Error::StaticMessage{"no resolved promise"}));
             }
           },
           executor);
@@ -826,15 +1292,15 @@ auto MkAnyPromise(Cntr&& container, Executor* executor) {
 
 template <typename Itr,
           typename TraitType = typename std::iterator_traits<Itr>::value_type,
-          typename ValueType = typename TraitType::value_type,
+          typename ValueType = typename TraitType::ValueType,
           typename R = ValueType>
 Promise<R> MkRacePromise(Itr begin, Itr end, Executor* executor) {
   return MkPromise<R>([begin, end, executor](auto&& resolver, auto&& rejector) {
     for (auto itr = begin; itr != end; ++itr) {
       itr->Then(
-          [resolver, rejector](base::Result<ValueType>&& r) {
+          [resolver, rejector](base::Result<ValueType>&& r) mutable {
             if (r) {
-              resolver(r.PassResult());
+              _::ResolveWith(resolver, std::move(r));
             } else {
               rejector(r.PassError());
             }
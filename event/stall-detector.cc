@@ -0,0 +1,327 @@
+#include "stall-detector.h"
+
+#include <common/common.h>
+#include <fmt/format.h>
+#include <pthread.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <optional>
+
+namespace base {
+namespace event {
+namespace {
+
+// the stack of a worker, captured by the worker itself in the signal handler
+struct StackCapture {
+  static constexpr int kMaxDepth = 64;
+
+  enum State : int {
+    kIdle,
+    kRequested,
+    kCapturing,
+    kDone,
+  };
+
+  std::atomic<int> state{kIdle};
+  void* frames[kMaxDepth];
+  int depth{0};
+};
+
+// the capture of the callback running in this thread, if any
+thread_local StackCapture* tls_capture = nullptr;
+
+void OnCaptureSignal(int, siginfo_t*, void* context) {
+  auto saved_errno = errno;
+
+  auto capture = tls_capture;
+  int requested = StackCapture::kRequested;
+  if (capture && capture->state.compare_exchange_strong(
+                     requested, StackCapture::kCapturing,
+                     std::memory_order_acquire)) {
+    capture->depth = GetSignalStackTrace(context, capture->frames,
+                                         StackCapture::kMaxDepth);
+    capture->state.store(StackCapture::kDone, std::memory_order_release);
+  }
+
+  errno = saved_errno;
+}
+
+void InstallCaptureHandler() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+    struct sigaction action = {};
+    action.sa_sigaction = OnCaptureSignal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    CHECK(sigaction(StallDetector::kSignal, &action, nullptr) == 0);
+  });
+}
+
+std::int64_t ToNanos(StallDetector::Clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+// written by its worker, read by the checking thread
+struct StallDetector::Slot {
+  std::thread::id id;
+  pthread_t thread;
+
+  // when the running callback started, zero if idle
+  std::atomic<std::int64_t> started{0};
+  // bumped for every callback, so a stall is reported once
+  std::atomic<std::uint64_t> sequence{0};
+  std::atomic<void*> site{nullptr};
+
+  // the sequence reported last, by the checking thread only
+  std::uint64_t reported{0};
+
+  StackCapture capture;
+
+  // the stall waiting for its stack, by the checking thread only
+  std::optional<Stall> pending;
+  Clock::time_point requested;
+
+  // the worker is not signalled once it has exited
+  std::mutex mutex;
+  bool alive{true};
+};
+
+StallDetector::StallDetector(Executor* executor, TimerWheel* wheel,
+                             Tick interval, Clock::duration threshold,
+                             StallCallback callback)
+    : executor_(executor),
+      wheel_(wheel),
+      interval_(interval),
+      threshold_(threshold),
+      callback_(std::move(callback)) {
+  DCHECK(executor_);
+  DCHECK(wheel_);
+  DCHECK(interval_ > 0);
+
+  if (!callback_) {
+    callback_ = Report;
+  }
+
+  InstallCaptureHandler();
+  wheel_->Schedule(this, interval_);
+}
+
+StallDetector::~StallDetector() {
+  std::vector<std::shared_ptr<Slot>> slots;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slots = slots_;
+  }
+
+  // report the stalls still waiting for their stacks with what they have
+  for (auto& slot : slots) {
+    if (slot->pending) {
+      CollectStack(slot.get(), true);
+    }
+  }
+}
+
+void StallDetector::Post(std::function<void()>&& f) {
+  executor_->Post(Wrap(std::move(f), __builtin_return_address(0)));
+}
+
+void StallDetector::PostBatch(std::function<void()>* tasks,
+                              std::size_t count) {
+  auto site = __builtin_return_address(0);
+  for (std::size_t i = 0; i < count; ++i) {
+    tasks[i] = Wrap(std::move(tasks[i]), site);
+  }
+  executor_->PostBatch(tasks, count);
+}
+
+std::function<void()> StallDetector::Wrap(std::function<void()>&& f,
+                                          void* site) {
+  return [this, f = std::move(f), site]() {
+    auto slot = LocalSlot();
+
+    // a callback maybe run inline by another one of this detector
+    auto prev_started = slot->started.load(std::memory_order_relaxed);
+    auto prev_site = slot->site.load(std::memory_order_relaxed);
+    auto prev_capture = tls_capture;
+
+    slot->site.store(site, std::memory_order_relaxed);
+    slot->sequence.store(slot->sequence.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+    slot->started.store(ToNanos(Clock::now()), std::memory_order_release);
+    tls_capture = &slot->capture;
+
+    f();
+
+    tls_capture = prev_capture;
+    slot->site.store(prev_site, std::memory_order_relaxed);
+    slot->started.store(prev_started, std::memory_order_release);
+  };
+}
+
+StallDetector::Slot* StallDetector::LocalSlot() {
+  // the slots of the detectors this thread has run callbacks of, indexed by
+  // their instance slots. they are marked dead once the thread exits, the
+  // ones of the destroyed detectors are released on a miss.
+  struct Entry {
+    std::uint64_t id{0};
+    std::shared_ptr<Slot> slot;
+  };
+  struct LocalSlots {
+    std::vector<Entry> entries;
+
+    ~LocalSlots() {
+      for (auto& entry : entries) {
+        if (entry.slot) {
+          std::lock_guard<std::mutex> lock(entry.slot->mutex);
+          entry.slot->alive = false;
+        }
+      }
+    }
+  };
+  thread_local LocalSlots tls_slots;
+
+  auto& entries = tls_slots.entries;
+  auto index = instance_.index();
+  if (index < entries.size() && entries[index].id == instance_.id()) {
+    return entries[index].slot.get();
+  }
+
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].id != 0 && !InstanceSlot::IsAlive(i, entries[i].id)) {
+      entries[i] = Entry{};
+    }
+  }
+  while (!entries.empty() && entries.back().id == 0) {
+    entries.pop_back();
+  }
+  if (index >= entries.size()) {
+    entries.resize(index + 1);
+  }
+
+  auto slot = std::make_shared<Slot>();
+  slot->id = std::this_thread::get_id();
+  slot->thread = pthread_self();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slots_.push_back(slot);
+  }
+  entries[index] = Entry{instance_.id(), slot};
+  return slot.get();
+}
+
+void StallDetector::Execute() {
+  Check();
+  wheel_->Schedule(this, interval_);
+}
+
+void StallDetector::Check() {
+  std::vector<std::shared_ptr<Slot>> slots;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slots = slots_;
+  }
+
+  auto now = ToNanos(Clock::now());
+  auto threshold =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(threshold_).count();
+
+  for (auto& slot : slots) {
+    if (slot->pending && !CollectStack(slot.get(), false)) {
+      continue;
+    }
+
+    auto started = slot->started.load(std::memory_order_acquire);
+    if (started == 0 || now - started < threshold) {
+      continue;
+    }
+
+    auto sequence = slot->sequence.load(std::memory_order_relaxed);
+    if (sequence == slot->reported) {
+      continue;
+    }
+    slot->reported = sequence;
+
+    Stall stall;
+    stall.thread = slot->id;
+    stall.running = std::chrono::nanoseconds(now - started);
+    stall.post_site = slot->site.load(std::memory_order_relaxed);
+    char symbol[kMaxSymbolLength];
+    stall.post_site_symbol =
+        stall.post_site && Symbolize(stall.post_site, symbol, sizeof(symbol))
+            ? std::string{symbol}
+            : fmt::format("{}", stall.post_site);
+
+    // reported by a later check, once the worker has captured its stack
+    slot->pending = std::move(stall);
+    if (!RequestStack(slot.get())) {
+      CollectStack(slot.get(), true);
+    }
+  }
+}
+
+bool StallDetector::RequestStack(Slot* slot) {
+  auto& capture = slot->capture;
+  int idle = StackCapture::kIdle;
+  if (!capture.state.compare_exchange_strong(idle, StackCapture::kRequested,
+                                             std::memory_order_relaxed)) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(slot->mutex);
+  if (!slot->alive || pthread_kill(slot->thread, kSignal) != 0) {
+    capture.state.store(StackCapture::kIdle, std::memory_order_relaxed);
+    return false;
+  }
+  slot->requested = Clock::now();
+  return true;
+}
+
+bool StallDetector::CollectStack(Slot* slot, bool force) {
+  static constexpr auto kTimeout = std::chrono::milliseconds(100);
+
+  auto& capture = slot->capture;
+  auto state = capture.state.load(std::memory_order_acquire);
+
+  // the worker has finished the callback, or ignores the signal. withdraw
+  // the request unless the handler is already capturing.
+  if (state == StackCapture::kRequested &&
+      (force || Clock::now() - slot->requested > kTimeout)) {
+    int requested = StackCapture::kRequested;
+    if (capture.state.compare_exchange_strong(requested, StackCapture::kIdle,
+                                              std::memory_order_relaxed)) {
+      state = StackCapture::kIdle;
+    } else {
+      state = capture.state.load(std::memory_order_acquire);
+    }
+  }
+
+  if (state == StackCapture::kDone) {
+    slot->pending->stack = SymbolizeStackTrace(capture.frames, capture.depth);
+    capture.state.store(StackCapture::kIdle, std::memory_order_relaxed);
+  } else if (state != StackCapture::kIdle && !force) {
+    return false;
+  }
+
+  auto stall = std::move(*slot->pending);
+  slot->pending.reset();
+  callback_(stall);
+  return true;
+}
+
+void StallDetector::Report(const Stall& stall) {
+  auto msg = fmt::format(
+      "[stall] callback posted at {} has run for {}ms, stack:\n{}",
+      stall.post_site_symbol,
+      std::chrono::duration_cast<std::chrono::milliseconds>(stall.running)
+          .count(),
+      stall.stack);
+  fmt::print(stderr, "{}\n", msg);
+}
+
+}  // namespace event
+}  // namespace base
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <common/instance-slot.h>
+#include <common/macros.h>
+#include <common/timer-wheel.h>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "executor.h"
+
+namespace base {
+namespace event {
+
+// |StallDetector| watches the callbacks posted to another executor, and
+// reports the ones which have run longer than |threshold|, e.g. blocked on a
+// synchronous disk I/O, which delays everything else queued on that worker.
+//
+// every worker records when it started its current callback. the check runs
+// every |interval| ticks of |wheel|, in the thread advancing the wheel. the
+// stack of a stalled worker is captured in the worker itself, by sending it
+// |kSignal|. the check never waits for it: the capture is collected and
+// symbolized on a later tick, and the stall is reported then, once.
+//
+// the post site is the caller of |Post|. callbacks posted through promises
+// are posted by the promise internals, so their post site is the same for
+// all of them, and only the stack tells them apart.
+//
+// the detector is created, checked and destroyed in the thread advancing
+// |wheel|, and must outlive the callbacks it has posted.
+class StallDetector : public Executor, private TimerEventBase {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // the signal interrupting a stalled worker to capture its stack
+  static constexpr int kSignal = SIGUSR2;
+
+  struct Stall {
+    std::thread::id thread;
+    Clock::duration running;
+    // the return address of the |Post| call, and its symbol
+    void* post_site;
+    std::string post_site_symbol;
+    // empty if the worker did not respond to the signal in time, or has
+    // finished the callback before
+    std::string stack;
+  };
+
+  using StallCallback = std::function<void(const Stall&)>;
+
+  // the stalls are printed to stderr if no callback is given
+  StallDetector(Executor* executor, TimerWheel* wheel, Tick interval,
+                Clock::duration threshold, StallCallback callback = nullptr);
+  ~StallDetector() override;
+
+  void Post(std::function<void()>&& f) override;
+  void PostBatch(std::function<void()>* tasks, std::size_t count) override;
+
+  // check the workers right away, without waiting for the next tick. the
+  // stalls found are reported once their stacks are collected, by a later
+  // check.
+  void Check();
+
+ private:
+  struct Slot;
+
+  void Execute() override;
+
+  std::function<void()> Wrap(std::function<void()>&& f, void* site);
+
+  // the slot of the calling worker
+  Slot* LocalSlot();
+
+  // interrupt the worker of |slot| to capture its stack, false if it can't
+  bool RequestStack(Slot* slot);
+
+  // report the pending stall of |slot| once its stack is captured, or the
+  // worker has not responded in time. true if it's reported.
+  bool CollectStack(Slot* slot, bool force);
+
+  static void Report(const Stall& stall);
+
+ private:
+  Executor* executor_;
+  TimerWheel* wheel_;
+  Tick interval_;
+  Clock::duration threshold_;
+  StallCallback callback_;
+
+  // indexes the thread local slot caches
+  InstanceSlot instance_;
+
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<Slot>> slots_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(StallDetector);
+};
+
+}  // namespace event
+}  // namespace base
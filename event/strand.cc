@@ -0,0 +1,79 @@
+#include "strand.h"
+
+#include <common/common.h>
+
+#include <algorithm>
+#include <thread>
+
+namespace base {
+namespace event {
+namespace {
+
+thread_local const StrandExecutor* tls_running_strand = nullptr;
+
+}  // namespace
+
+StrandExecutor::StrandExecutor(Executor* executor, std::size_t budget)
+    : executor_(executor), budget_(budget) {
+  DCHECK(executor_);
+  DCHECK(budget_ > 0);
+}
+
+void StrandExecutor::Post(std::function<void()>&& f) {
+  tasks_.Push(std::move(f));
+
+  if (pending_.fetch_add(1, std::memory_order_acq_rel) == 0) {
+    executor_->Post([this]() { Drain(); });
+  }
+}
+
+void StrandExecutor::PostBatch(std::function<void()>* tasks,
+                               std::size_t count) {
+  if (count == 0) {
+    return;
+  }
+  tasks_.PushBatch(tasks, count);
+
+  if (pending_.fetch_add(count, std::memory_order_acq_rel) == 0) {
+    executor_->Post([this]() { Drain(); });
+  }
+}
+
+bool StrandExecutor::IsRunningInThisThread() const {
+  return tls_running_strand == this;
+}
+
+void StrandExecutor::Drain() {
+  auto prev = tls_running_strand;
+  tls_running_strand = this;
+
+  // run only the counted callbacks, a callback popped before it's counted
+  // would drop |pending_| to zero early, and let a poster schedule a second
+  // drain.
+  auto limit = std::min(budget_, pending_.load(std::memory_order_acquire));
+
+  std::size_t count = 0;
+  std::function<void()> task;
+  while (count < limit) {
+    if (!tasks_.Pop(&task)) {
+      // counted but not linked yet, the producer is between |Push| steps
+      std::this_thread::yield();
+      continue;
+    }
+
+    NO_EXCEPT(task());
+    task = nullptr;
+    ++count;
+  }
+
+  tls_running_strand = prev;
+
+  // the next poster schedules the drain if we are done, otherwise give the
+  // worker back and continue later.
+  if (pending_.fetch_sub(count, std::memory_order_acq_rel) != count) {
+    executor_->Post([this]() { Drain(); });
+  }
+}
+
+}  // namespace event
+}  // namespace base
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <common/macros.h>
+
+#include <atomic>
+#include <functional>
+
+#include "executor.h"
+#include "mpsc-queue.h"
+
+namespace base {
+namespace event {
+
+// |StrandExecutor| serializes the callbacks posted to it on top of another
+// executor, without locks. the callbacks run one at a time in FIFO order, so
+// state only touched from a strand needs no mutex, while the work is still
+// spread over a shared pool.
+//
+// the posted callbacks are kept in a lock-free MPSC queue. only the poster
+// which finds the strand idle schedules a drain on the underlying executor,
+// so a strand never occupies two workers at once. a drain runs at most
+// |budget| callbacks, then gives the worker back by posting the next drain.
+//
+// the strand must outlive the drains it has scheduled.
+class StrandExecutor : public Executor {
+ public:
+  explicit StrandExecutor(Executor* executor, std::size_t budget = 64);
+
+  void Post(std::function<void()>&& f) override;
+  void PostBatch(std::function<void()>* tasks, std::size_t count) override;
+
+  // whether the calling thread is running a callback of this strand
+  bool IsRunningInThisThread() const;
+
+ private:
+  void Drain();
+
+ private:
+  Executor* executor_;
+  std::size_t budget_;
+
+  // the number of callbacks posted and not run yet
+  std::atomic<std::size_t> pending_{0};
+  MpscQueue<std::function<void()>> tasks_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(StrandExecutor);
+};
+
+}  // namespace event
+}  // namespace base
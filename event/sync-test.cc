@@ -0,0 +1,147 @@
+#define CATCH_CONFIG_MAIN
+#include "sync.h"
+
+#include <catch-include.h>
+
+#include <thread>
+
+#include "mock-executor.h"
+
+namespace base {
+namespace event {
+
+TEST_CASE("mutex", "[sync]") {
+  MockExecutor exec;
+  AsyncMutex mutex;
+
+  std::vector<int> order;
+  std::vector<AsyncMutex::Guard> guards;
+  std::vector<Promise<AsyncMutex::Guard>> waiting;
+
+  auto p0 = mutex.Lock(&exec);
+  REQUIRE(p0.IsSatisfied());
+  REQUIRE(mutex.IsLocked());
+  REQUIRE(!mutex.TryLock());
+
+  for (int i = 1; i <= 2; ++i) {
+    auto& p = waiting.emplace_back(mutex.Lock(&exec));
+    REQUIRE(p.IsEmpty());
+    p.Then(
+        [&, i](Result<AsyncMutex::Guard>&& r) {
+          order.push_back(i);
+          guards.push_back(r.PassResult());
+        },
+        &exec);
+  }
+
+  p0.Then(
+      [&](Result<AsyncMutex::Guard>&& r) {
+        auto guard = r.PassResult();
+        order.push_back(0);
+      },
+      &exec);
+  exec.Run();
+
+  // the guard of p0 is dropped, the waiters take turns in FIFO order
+  REQUIRE(order == std::vector<int>{0, 1});
+  guards.clear();
+  exec.Run();
+
+  REQUIRE(order == std::vector<int>{0, 1, 2});
+  REQUIRE(mutex.IsLocked());
+  guards.clear();
+  REQUIRE(!mutex.IsLocked());
+}
+
+TEST_CASE("semaphore", "[sync]") {
+  MockExecutor exec;
+  AsyncSemaphore sem(3);
+
+  REQUIRE(sem.Acquire(2, &exec).IsSatisfied());
+  auto p1 = sem.Acquire(2, &exec);
+  auto p2 = sem.Acquire(1, &exec);
+
+  // FIFO, p2 does not overtake p1 even if a permit is available
+  REQUIRE(p1.IsEmpty());
+  REQUIRE(p2.IsEmpty());
+  REQUIRE(!sem.TryAcquire());
+
+  sem.Release(2);
+  exec.Run();
+
+  REQUIRE(p1.IsSatisfied());
+  REQUIRE(p2.IsSatisfied());
+  REQUIRE(sem.available() == 0);
+}
+
+TEST_CASE("woken waiters dropped unrun", "[sync]") {
+  MockExecutor exec;
+
+  // e.g. by an executor shutting down
+  AsyncMutex mutex;
+  auto guard = mutex.TryLock();
+  REQUIRE(guard);
+  auto p0 = mutex.Lock(&exec);
+  guard->Unlock();
+  REQUIRE(exec.queue.size() == 1);
+  REQUIRE(mutex.IsLocked());
+  exec.queue.clear();
+  REQUIRE(p0.IsEmpty());
+  REQUIRE(!mutex.IsLocked());
+  REQUIRE(mutex.Lock(&exec).IsSatisfied());
+
+  AsyncSemaphore sem(1);
+  REQUIRE(sem.TryAcquire());
+  auto p1 = sem.Acquire(&exec);
+  sem.Release();
+  REQUIRE(exec.queue.size() == 1);
+  REQUIRE(sem.available() == 0);
+  exec.queue.clear();
+  REQUIRE(p1.IsEmpty());
+  REQUIRE(sem.available() == 1);
+  REQUIRE(sem.Acquire(&exec).IsSatisfied());
+}
+
+TEST_CASE("latch", "[sync]") {
+  MockExecutor exec;
+  AsyncLatch latch(2);
+
+  auto p = latch.Wait(&exec);
+  latch.CountDown();
+  exec.Run();
+  REQUIRE(p.IsEmpty());
+
+  latch.CountDown();
+  exec.Run();
+  REQUIRE(p.IsSatisfied());
+  REQUIRE(latch.Wait(&exec).IsSatisfied());
+}
+
+TEST_CASE("mutex across threads", "[sync]") {
+  static constexpr int kThreads = 4;
+  static constexpr int kCount = 10000;
+
+  AsyncMutex mutex;
+  int counter = 0;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < kCount;) {
+        if (auto guard = mutex.TryLock(); guard) {
+          ++counter;
+          ++i;
+        }
+      }
+    });
+  }
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  REQUIRE(counter == kThreads * kCount);
+}
+
+}  // namespace event
+}  // namespace base
@@ -0,0 +1,222 @@
+#include "sync.h"
+
+namespace base {
+namespace event {
+namespace _ {
+
+AsyncWaiterQueue::~AsyncWaiterQueue() {
+  for (auto waiter = PopAll(); waiter;) {
+    auto next = waiter->next;
+    delete waiter;
+    waiter = next;
+  }
+}
+
+void AsyncWaiterQueue::Push(AsyncWaiter* waiter) {
+  waiter->next = nullptr;
+  if (tail_) {
+    tail_->next = waiter;
+  } else {
+    head_ = waiter;
+  }
+  tail_ = waiter;
+}
+
+AsyncWaiter* AsyncWaiterQueue::Pop() {
+  auto waiter = head_;
+  if (waiter) {
+    head_ = waiter->next;
+    if (!head_) {
+      tail_ = nullptr;
+    }
+    waiter->next = nullptr;
+  }
+  return waiter;
+}
+
+AsyncWaiter* AsyncWaiterQueue::PopAll() {
+  auto head = head_;
+  head_ = tail_ = nullptr;
+  return head;
+}
+
+void AsyncWaiterQueue::WakeAll(AsyncWaiter* head) {
+  while (head) {
+    auto waiter = head;
+    head = head->next;
+    waiter->Wake();
+    delete waiter;
+  }
+}
+
+bool AsyncPermits::TryTake(std::size_t n) {
+  auto permits = permits_.load(std::memory_order_relaxed);
+  while (permits >= n) {
+    if (permits_.compare_exchange_weak(permits, permits - n,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool AsyncPermits::TryAcquire(std::size_t n) {
+  // do not barge in front of the waiters
+  if (waiting_.load(std::memory_order_relaxed) != 0) {
+    return false;
+  }
+  return TryTake(n);
+}
+
+void AsyncPermits::Acquire(AsyncWaiter* waiter) {
+  if (TryAcquire(waiter->count)) {
+    waiter->Wake();
+    delete waiter;
+    return;
+  }
+
+  AsyncWaiter* granted = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // pairs with the fence in |Release|, either |Grant| below sees the
+    // released permits, or the releaser sees us waiting.
+    waiting_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    waiters_.Push(waiter);
+    granted = Grant();
+  }
+  AsyncWaiterQueue::WakeAll(granted);
+}
+
+void AsyncPermits::Release(std::size_t n) {
+  permits_.fetch_add(n, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+
+  AsyncWaiter* granted = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    granted = Grant();
+  }
+  AsyncWaiterQueue::WakeAll(granted);
+}
+
+AsyncWaiter* AsyncPermits::Grant() {
+  AsyncWaiterQueue granted;
+  while (!waiters_.IsEmpty() && TryTake(waiters_.front()->count)) {
+    granted.Push(waiters_.Pop());
+    waiting_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return granted.PopAll();
+}
+
+struct VoidWaiter : AsyncWaiter {
+  // the permits granted to the waiter, none for a latch
+  AsyncPermits* permits{nullptr};
+  Promise<void> promise;
+
+  // a cancelled promise gives the permits back right away
+  void Wake() override {
+    PostOrRun(executor, [p = promise, ticket = AsyncPermitTicket(
+                                          permits, count)]() mutable {
+      if (p.Resolve()) {
+        ticket.Dismiss();
+      }
+    });
+  }
+};
+
+}  // namespace _
+
+Promise<void> AsyncSemaphore::Acquire(std::size_t n, Executor* executor) {
+  if (permits_.TryAcquire(n)) {
+    return MkResolvedPromise();
+  }
+
+  auto waiter = new _::VoidWaiter;
+  waiter->count = n;
+  waiter->executor = executor;
+  waiter->permits = &permits_;
+  auto promise = waiter->promise;
+
+  permits_.Acquire(waiter);
+  return promise;
+}
+
+struct AsyncMutex::Waiter : _::AsyncWaiter {
+  AsyncMutex* mutex;
+  Promise<Guard> promise;
+
+  // a cancelled promise drops the guard, which unlocks right away. the lock
+  // is held by the ticket until the guard is built.
+  void Wake() override {
+    _::PostOrRun(executor, [p = promise, m = mutex,
+                            ticket = _::AsyncPermitTicket(
+                                &mutex->permits_, 1)]() mutable {
+      ticket.Dismiss();
+      p.Resolve(Guard{m});
+    });
+  }
+};
+
+Promise<AsyncMutex::Guard> AsyncMutex::Lock(Executor* executor) {
+  if (permits_.TryAcquire(1)) {
+    return MkResolvedPromise(Guard{this});
+  }
+
+  auto waiter = new Waiter;
+  waiter->count = 1;
+  waiter->executor = executor;
+  waiter->mutex = this;
+  auto promise = waiter->promise;
+
+  permits_.Acquire(waiter);
+  return promise;
+}
+
+std::optional<AsyncMutex::Guard> AsyncMutex::TryLock() {
+  if (permits_.TryAcquire(1)) {
+    return Guard{this};
+  }
+  return std::nullopt;
+}
+
+void AsyncLatch::CountDown(std::size_t n) {
+  auto count = count_.fetch_sub(n, std::memory_order_acq_rel);
+  DCHECK(count >= n);
+  if (count != n) {
+    return;
+  }
+
+  _::AsyncWaiter* waiters = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    waiters = waiters_.PopAll();
+  }
+  _::AsyncWaiterQueue::WakeAll(waiters);
+}
+
+Promise<void> AsyncLatch::Wait(Executor* executor) {
+  if (TryWait()) {
+    return MkResolvedPromise();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (TryWait()) {
+    return MkResolvedPromise();
+  }
+
+  auto waiter = new _::VoidWaiter;
+  waiter->executor = executor;
+  auto promise = waiter->promise;
+
+  waiters_.Push(waiter);
+  return promise;
+}
+
+}  // namespace event
+}  // namespace base
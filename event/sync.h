@@ -0,0 +1,240 @@
+#pragma once
+
+#include <common/check.h>
+#include <common/macros.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "executor.h"
+#include "promise.h"
+
+namespace base {
+namespace event {
+namespace _ {
+
+// |AsyncWaiter| is a node of the intrusive FIFO waiter queue, it is allocated
+// only when the caller has to wait.
+struct AsyncWaiter {
+  AsyncWaiter* next{nullptr};
+  std::size_t count{0};
+  Executor* executor{nullptr};
+
+  virtual ~AsyncWaiter() {}
+
+  // settle the waiting promise in |executor|, called without any lock held
+  virtual void Wake() = 0;
+};
+
+class AsyncWaiterQueue {
+ public:
+  AsyncWaiterQueue() = default;
+  // the promises of the remaining waiters are never settled
+  ~AsyncWaiterQueue();
+
+  bool IsEmpty() const { return head_ == nullptr; }
+  AsyncWaiter* front() const { return head_; }
+
+  void Push(AsyncWaiter* waiter);
+  AsyncWaiter* Pop();
+
+  // detach the whole queue
+  AsyncWaiter* PopAll();
+
+  // wake every waiter of a detached queue, and free them
+  static void WakeAll(AsyncWaiter* head);
+
+ private:
+  AsyncWaiter* head_{nullptr};
+  AsyncWaiter* tail_{nullptr};
+
+  DISALLOW_COPY_AND_ASSIGN(AsyncWaiterQueue);
+};
+
+// |AsyncPermits| counts the permits of |AsyncSemaphore| and |AsyncMutex|.
+// acquiring without contention is a single CAS, the queue lock is taken only
+// when there are waiters. the waiters are granted permits in FIFO order, and
+// the fast path does not barge in front of them.
+class AsyncPermits {
+ public:
+  explicit AsyncPermits(std::size_t permits) : permits_(permits) {}
+
+  bool TryAcquire(std::size_t n);
+
+  // acquire |n| permits for |waiter|. it's woken once they are granted, which
+  // maybe right away. the waiter is owned and freed by |AsyncPermits|.
+  void Acquire(AsyncWaiter* waiter);
+
+  void Release(std::size_t n);
+
+  std::size_t available() const {
+    return permits_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  bool TryTake(std::size_t n);
+
+  // take the permits of the leading waiters, must be called with lock held
+  AsyncWaiter* Grant();
+
+ private:
+  std::atomic<std::size_t> permits_;
+  // number of waiters queued or about to queue
+  std::atomic<std::size_t> waiting_{0};
+
+  std::mutex mutex_;
+  AsyncWaiterQueue waiters_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(AsyncPermits);
+};
+
+// |AsyncPermitTicket| holds permits granted to a waiter until its callback
+// runs, the permits are given back if the executor destroys it unrun
+class AsyncPermitTicket {
+ public:
+  AsyncPermitTicket(AsyncPermits* permits, std::size_t n)
+      : permits_(permits), n_(n) {}
+
+  AsyncPermitTicket(AsyncPermitTicket&& other) noexcept
+      : permits_(std::exchange(other.permits_, nullptr)), n_(other.n_) {}
+  // |std::function| has to be copyable, but the executors move the
+  // callbacks. a copy holds no permit, so copying a ticket holding some
+  // would lose them on either side.
+  AsyncPermitTicket(const AsyncPermitTicket& other)
+      : permits_(nullptr), n_(other.n_) {
+    DCHECK(!other.permits_);
+  }
+
+  ~AsyncPermitTicket() { Release(); }
+
+  // the permits are handed over to the waiter
+  void Dismiss() { permits_ = nullptr; }
+
+  void Release() {
+    if (auto permits = std::exchange(permits_, nullptr)) {
+      permits->Release(n_);
+    }
+  }
+
+ private:
+  AsyncPermits* permits_;
+  std::size_t n_;
+};
+
+template <typename F>
+void PostOrRun(Executor* executor, F&& f) {
+  if (executor) {
+    executor->Post(std::forward<F>(f));
+  } else {
+    f();
+  }
+}
+
+}  // namespace _
+
+// |AsyncSemaphore| hands out permits by promises instead of parking the
+// calling thread.
+class AsyncSemaphore {
+ public:
+  explicit AsyncSemaphore(std::size_t permits) : permits_(permits) {}
+
+  // resolved in |executor| once |n| permits are acquired. an uncontended
+  // acquire still makes a resolved promise, |TryAcquire| does not.
+  Promise<void> Acquire(std::size_t n, Executor* executor);
+  Promise<void> Acquire(Executor* executor) { return Acquire(1, executor); }
+
+  bool TryAcquire(std::size_t n = 1) { return permits_.TryAcquire(n); }
+
+  void Release(std::size_t n = 1) { permits_.Release(n); }
+
+  std::size_t available() const { return permits_.available(); }
+
+ private:
+  _::AsyncPermits permits_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(AsyncSemaphore);
+};
+
+// |AsyncMutex| guards shared state between callbacks running in executors.
+// the lock is held as long as the |Guard| is alive.
+class AsyncMutex {
+ public:
+  class Guard {
+   public:
+    Guard() = default;
+    Guard(Guard&& other) : mutex_(other.mutex_) { other.mutex_ = nullptr; }
+    Guard& operator=(Guard&& other) {
+      if (this != &other) {
+        Unlock();
+        mutex_ = other.mutex_;
+        other.mutex_ = nullptr;
+      }
+      return *this;
+    }
+    ~Guard() { Unlock(); }
+
+    bool OwnsLock() const { return mutex_ != nullptr; }
+    operator bool() const { return OwnsLock(); }
+
+    void Unlock() {
+      if (mutex_) {
+        Pass(&mutex_)->Unlock();
+      }
+    }
+
+   private:
+    explicit Guard(AsyncMutex* mutex) : mutex_(mutex) {}
+
+    AsyncMutex* mutex_{nullptr};
+
+    friend class AsyncMutex;
+    DISALLOW_COPY_AND_ASSIGN(Guard);
+  };
+
+  AsyncMutex() : permits_(1) {}
+
+  // resolved in |executor| once the lock is held. an uncontended lock still
+  // makes a resolved promise, |TryLock| does not.
+  Promise<Guard> Lock(Executor* executor);
+
+  std::optional<Guard> TryLock();
+
+  bool IsLocked() const { return permits_.available() == 0; }
+
+ private:
+  struct Waiter;
+
+  void Unlock() { permits_.Release(1); }
+
+  _::AsyncPermits permits_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(AsyncMutex);
+};
+
+// |AsyncLatch| is a single-use barrier, the waiters are resolved once it has
+// been counted down to zero.
+class AsyncLatch {
+ public:
+  explicit AsyncLatch(std::size_t count) : count_(count) {}
+
+  void CountDown(std::size_t n = 1);
+
+  // resolved in |executor| once the count reaches zero
+  Promise<void> Wait(Executor* executor);
+
+  bool TryWait() const { return count_.load(std::memory_order_acquire) == 0; }
+
+ private:
+  std::atomic<std::size_t> count_;
+
+  std::mutex mutex_;
+  _::AsyncWaiterQueue waiters_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(AsyncLatch);
+};
+
+}  // namespace event
+}  // namespace base
@@ -0,0 +1,133 @@
+#include "thread-pool.h"
+
+#include <common/common.h>
+#include <common/crash-handler.h>
+
+namespace base {
+namespace event {
+
+ThreadPoolExecutor::ThreadPoolExecutor(std::size_t threads)
+    : running_(threads) {
+  DCHECK(threads > 0);
+  workers_.reserve(threads);
+  for (std::size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back([this]() { Run(); });
+  }
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor() {
+  Stop(ShutdownMode::kDrain);
+
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPoolExecutor::Post(std::function<void()>&& f) {
+  bool queued = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ != State::kStopped) {
+      tasks_.push_back(std::move(f));
+      queued = true;
+    }
+  }
+  if (queued) {
+    cond_.notify_one();
+  }
+  // otherwise dropped, and destroyed by the caller out of the lock
+}
+
+void ThreadPoolExecutor::PostBatch(std::function<void()>* tasks,
+                                   std::size_t count) {
+  if (count == 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ == State::kStopped) {
+      count = 0;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+      tasks_.push_back(std::move(tasks[i]));
+    }
+  }
+  if (count != 0) {
+    cond_.notify_one();
+  }
+}
+
+Promise<void> ThreadPoolExecutor::Shutdown(ShutdownMode mode,
+                                           Executor* executor) {
+  DCHECK(executor);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!quiesced_executor_) {
+      quiesced_executor_ = executor;
+    }
+  }
+  Stop(mode);
+  return quiesced_;
+}
+
+void ThreadPoolExecutor::Stop(ShutdownMode mode) {
+  std::deque<std::function<void()>> dropped;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ == State::kRunning) {
+      state_ = State::kDraining;
+    }
+    if (mode == ShutdownMode::kCancel && state_ != State::kStopped) {
+      state_ = State::kStopped;
+      dropped.swap(tasks_);
+    }
+  }
+  cond_.notify_all();
+
+  // cancel the promises waiting for the dropped callbacks, out of the lock
+  dropped.clear();
+}
+
+void ThreadPoolExecutor::Run() {
+  InstallCrashStack();
+
+  Executor* executor = nullptr;
+  for (;;) {
+    std::function<void()> task;
+    bool wake_next = false;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ++idle_;
+      cond_.wait(lock, [this]() {
+        return state_ != State::kRunning || !tasks_.empty();
+      });
+      --idle_;
+      if (tasks_.empty()) {
+        // the last worker returning stops the pool under the same lock it
+        // sees the queue empty, so nothing is queued after it has left
+        if (--running_ == 0) {
+          state_ = State::kStopped;
+          executor = quiesced_executor_;
+        }
+        break;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+      wake_next = !tasks_.empty() && idle_ > 0;
+    }
+    if (wake_next) {
+      cond_.notify_one();
+    }
+    NO_EXCEPT(task());
+  }
+
+  // resolved by a hop to the executor of the caller, who may be attaching
+  // its callback meanwhile
+  if (executor) {
+    auto quiesced = quiesced_;
+    executor->Post([quiesced]() mutable { quiesced.Resolve(); });
+  }
+}
+
+}  // namespace event
+}  // namespace base
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <common/macros.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "executor.h"
+#include "promise.h"
+
+namespace base {
+namespace event {
+
+// |ThreadPoolExecutor| runs the posted callbacks on a fixed number of worker
+// threads, in FIFO order.
+class ThreadPoolExecutor : public Executor {
+ public:
+  explicit ThreadPoolExecutor(std::size_t threads);
+
+  // shut down by |ShutdownMode::kDrain| if not yet, and join the workers
+  ~ThreadPoolExecutor() override;
+
+  // the callbacks posted after the shutdown are dropped
+  void Post(std::function<void()>&& f) override;
+
+  // the batch is queued under a single lock, and only one worker is woken
+  // up. a woken worker wakes up the next idle one while callbacks are left.
+  void PostBatch(std::function<void()>* tasks, std::size_t count) override;
+
+  // stop the workers, the returned promise is resolved in |executor| once
+  // all of them have returned, the running callbacks are not interrupted.
+  // |executor| is the one of the caller, the promise is not resolved by a
+  // worker in place. the later calls only return the same promise.
+  Promise<void> Shutdown(ShutdownMode mode, Executor* executor);
+
+  std::size_t size() const { return workers_.size(); }
+
+ private:
+  enum class State : std::uint8_t {
+    kRunning,
+    // the workers return once the queue is empty
+    kDraining,
+    // no callback is run or queued any more
+    kStopped,
+  };
+
+  void Stop(ShutdownMode mode);
+  void Run();
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::function<void()>> tasks_;
+  State state_{State::kRunning};
+  // the number of workers waiting for callbacks
+  std::size_t idle_{0};
+  // the number of workers not returned yet
+  std::size_t running_{0};
+
+  Promise<void> quiesced_;
+  // set by |Shutdown|, the promise is not resolved if nobody waits for it
+  Executor* quiesced_executor_{nullptr};
+
+  std::vector<std::thread> workers_;
+
+  DISALLOW_COPY_MOVE_AND_ASSIGN(ThreadPoolExecutor);
+};
+
+}  // namespace event
+}  // namespace base